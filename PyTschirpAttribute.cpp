@@ -7,35 +7,52 @@
 
 #include "PyTschirpAttribute.h"
 
+#include "PyTschirpStats.h"
+
 #include "Capability.h"
 
 #include "SynthParameterDefinition.h"
-#include "DetailedParametersCapability.h"
+
+#ifdef _MSC_VER
+#pragma warning ( push )
+#pragma warning ( disable: 4100 )
+#endif
+#include <pybind11/stl.h>
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
 
 namespace py = pybind11;
 
-PyTschirpAttribute::PyTschirpAttribute(std::shared_ptr<midikraft::Patch> patch, std::string const &param) : patch_(patch)
+PyTschirpAttribute::PyTschirpAttribute(std::shared_ptr<midikraft::Patch> patch, std::string const &param) :
+	PyTschirpAttribute(std::make_shared<PyTschirpPatchSlot>(patch, std::weak_ptr<midikraft::Synth>()), PyTschirpParameterIndex::forPatch(patch), param)
+{
+}
+
+PyTschirpAttribute::PyTschirpAttribute(std::shared_ptr<midikraft::Patch> patch, std::string const &param, int targetLayerNo) :
+	PyTschirpAttribute(std::make_shared<PyTschirpPatchSlot>(patch, std::weak_ptr<midikraft::Synth>()), PyTschirpParameterIndex::forPatch(patch), param, targetLayerNo)
+{
+}
+
+PyTschirpAttribute::PyTschirpAttribute(std::shared_ptr<PyTschirpPatchSlot> slot, std::shared_ptr<PyTschirpParameterIndex> index, std::string const &param) : slot_(slot), index_(index)
 {
-	def_ = defByName(param);
+	handle_ = handleByName(param, -1);
 }
 
-PyTschirpAttribute::PyTschirpAttribute(std::shared_ptr<midikraft::Patch> patch, std::string const &param, int targetLayerNo) : patch_(patch)
+PyTschirpAttribute::PyTschirpAttribute(std::shared_ptr<PyTschirpPatchSlot> slot, std::shared_ptr<PyTschirpParameterIndex> index, std::string const &param, int targetLayerNo) : slot_(slot), index_(index)
 {
-	def_ = defByName(param);
-	auto layerAccess = midikraft::Capability::hasCapability<midikraft::SynthMultiLayerParameterCapability>(def_);
-	if (!layerAccess) {
+	handle_ = handleByName(param, targetLayerNo);
+	if (!handle_ || !handle_->capabilities().multiLayer) {
 		throw std::runtime_error("PyTschirp: Program Error: Parameter set does not support multi layers");
 	}
-	// This parameter definition targets a specific layer. This is used e.g. to access either Layer A or Layer B of a Prophet Rev2
-	layerAccess->setSourceLayer(targetLayerNo);
-	layerAccess->setTargetLayer(targetLayerNo);
+	// This handle targets a specific layer. This is used e.g. to access either Layer A or Layer B of a Prophet Rev2
 }
 
 void PyTschirpAttribute::set(int value)
 {
-	auto intParam = midikraft::Capability::hasCapability<midikraft::SynthIntParameterCapability>(def_);
-	if (intParam) {
-		intParam->setInPatch(*patch_, value);
+	PyTschirpStats::ScopedTimer timer(PyTschirpStats::ATTRIBUTE_SET);
+	if (handle_ && handle_->capabilities().intParam) {
+		handle_->setInPatch(*slot_->writablePatch(), value);
 	}
 	else {
 		throw std::runtime_error("PyTschirp: Illegal operation, can't set int type");
@@ -44,9 +61,9 @@ void PyTschirpAttribute::set(int value)
 
 void PyTschirpAttribute::set(std::vector<int> data)
 {
-	auto vectorParam = midikraft::Capability::hasCapability<midikraft::SynthVectorParameterCapability>(def_);
-	if (vectorParam) {
-		vectorParam->setInPatch(*patch_, data);
+	PyTschirpStats::ScopedTimer timer(PyTschirpStats::ATTRIBUTE_SET);
+	if (handle_ && handle_->capabilities().vectorParam) {
+		handle_->setInPatch(*slot_->writablePatch(), data);
 	}
 	else {
 		throw std::runtime_error("PyTschirp: Illegal operation, can't set vector type");
@@ -55,31 +72,18 @@ void PyTschirpAttribute::set(std::vector<int> data)
 
 py::object PyTschirpAttribute::get() const
 {
-	if (!def_) {
+	PyTschirpStats::ScopedTimer timer(PyTschirpStats::ATTRIBUTE_GET);
+	if (!handle_) {
 		return py::none();
 	}
-	if ((def_->type() == midikraft::SynthParameterDefinition::ParamType::INT_ARRAY)
-		|| (def_->type() == midikraft::SynthParameterDefinition::ParamType::LOOKUP_ARRAY))
+	if (handle_->capabilities().isVector)
 	{
-		auto vectorParam = midikraft::Capability::hasCapability<midikraft::SynthVectorParameterCapability>(def_);
-		if (vectorParam) {
-			std::vector<int> value;
-			if (!vectorParam->valueInPatch(*patch_, value)) {
-				throw std::runtime_error("PyTschirp: Internal error getting array from patch data!");
-			}
-			py::list result;
-			for (auto val : value) result.append(val);
-			return result;
-		}
-		else {
-			throw std::runtime_error("PyTschirp: Invalid type int array but no SynthVectorParameterCapability implemented");
-		}
+		return py::cast(vectorValue());
 	}
 	else {
-		auto intParam = midikraft::Capability::hasCapability<midikraft::SynthIntParameterCapability>(def_);
-		if (intParam) {
+		if (handle_->capabilities().intParam) {
 			int value;
-			if (intParam->valueInPatch(*patch_, value)) {
+			if (handle_->valueInPatch(*slot_->patch(), value)) {
 				return py::int_(value);
 			}
 		}
@@ -91,10 +95,26 @@ py::object PyTschirpAttribute::get() const
 	throw std::runtime_error("PyTschirp: Invalid attribute index in patch");
 }
 
+py::array_t<int> PyTschirpAttribute::asArray() const
+{
+	if (!handle_) {
+		throw std::runtime_error("PyTschirp: Unknown attribute, can't create array");
+	}
+	if (handle_->capabilities().isVector)
+	{
+		auto value = vectorValue();
+		return py::array_t<int>((py::ssize_t) value.size(), value.data());
+	}
+	else {
+		int value = get().cast<int>();
+		return py::array_t<int>(1, &value);
+	}
+}
+
 std::string PyTschirpAttribute::asText() const
 {
-	if (def_) {
-		return def_->valueInPatchToText(*patch_);
+	if (handle_) {
+		return handle_->valueInPatchToText(*slot_->patch());
 	}
 	else {
 		return "unknown attribute";
@@ -103,18 +123,31 @@ std::string PyTschirpAttribute::asText() const
 
 std::shared_ptr <midikraft::SynthParameterDefinition> PyTschirpAttribute::def()
 {
-	return def_;
+	return handle_ ? handle_->capabilities().def : nullptr;
 }
 
-std::shared_ptr<midikraft::SynthParameterDefinition> PyTschirpAttribute::defByName(std::string const &name) const
+PyTschirpParameterIndex::Handle const *PyTschirpAttribute::handle() const
 {
-	auto params = midikraft::Capability::hasCapability<midikraft::DetailedParametersCapability>(patch_);
-	if (params) {
-		for (auto param : params->allParameterDefinitions()) {
-			if (param->name() == name) {
-				return param;
-			}
+	return handle_;
+}
+
+std::vector<int> PyTschirpAttribute::vectorValue() const
+{
+	if (handle_->capabilities().vectorParam) {
+		std::vector<int> value;
+		if (!handle_->valueInPatch(*slot_->patch(), value)) {
+			throw std::runtime_error("PyTschirp: Internal error getting array from patch data!");
 		}
+		return value;
+	}
+	else {
+		throw std::runtime_error("PyTschirp: Invalid type int array but no SynthVectorParameterCapability implemented");
 	}
-	return {};
+}
+
+PyTschirpParameterIndex::Handle const *PyTschirpAttribute::handleByName(std::string const &name, int layerNo) const
+{
+	PyTschirpStats::ScopedTimer timer(PyTschirpStats::ATTRIBUTE_LOOKUP);
+	int index = index_->indexOf(name);
+	return index != -1 ? &index_->handle(index, layerNo) : nullptr;
 }
@@ -8,11 +8,15 @@
 
 #include "Patch.h"
 
+#include "PyTschirpParameterIndex.h"
+#include "PyTschirpPatchSlot.h"
+
 #ifdef _MSC_VER
 #pragma warning ( push )
 #pragma warning ( disable: 4100 )
 #endif
 #include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
 #ifdef _MSC_VER
 #pragma warning(pop)
 #endif
@@ -21,21 +25,29 @@ class PyTschirpAttribute {
 public:
 	PyTschirpAttribute(std::shared_ptr<midikraft::Patch> patch, std::string const &param);
 	PyTschirpAttribute(std::shared_ptr<midikraft::Patch> patch, std::string const &param, int targetLayerNo);
+	// Same, but for the slot of a PyTschirp with the index of the patch already known, this saves looking it up by the patch type
+	PyTschirpAttribute(std::shared_ptr<PyTschirpPatchSlot> slot, std::shared_ptr<PyTschirpParameterIndex> index, std::string const &param);
+	PyTschirpAttribute(std::shared_ptr<PyTschirpPatchSlot> slot, std::shared_ptr<PyTschirpParameterIndex> index, std::string const &param, int targetLayerNo);
 
 	void set(int value);
 	void set(std::vector<int> data);
 
 	pybind11::object get() const;
+	pybind11::array_t<int> asArray() const; // Vector values as numpy array instead of a list of Python ints
 
 	std::string asText() const;
 
 	// Bindings not for python
 	std::shared_ptr <midikraft::SynthParameterDefinition> def();
+	PyTschirpParameterIndex::Handle const *handle() const; // nullptr for an unknown attribute
 
 private:
-	std::shared_ptr<midikraft::SynthParameterDefinition> defByName(std::string const &name) const;
+	std::vector<int> vectorValue() const;
+
+	PyTschirpParameterIndex::Handle const *handleByName(std::string const &name, int layerNo) const;
 
-	std::shared_ptr<midikraft::Patch> patch_;
-	std::shared_ptr<midikraft::SynthParameterDefinition> def_;
+	std::shared_ptr<PyTschirpPatchSlot> slot_;
+	std::shared_ptr<PyTschirpParameterIndex> index_;
+	PyTschirpParameterIndex::Handle const *handle_; // Owned by index_, nullptr for an unknown attribute
 };
 
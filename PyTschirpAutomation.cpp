@@ -0,0 +1,390 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "PyTschirpAutomation.h"
+
+#include "PyTschirpHelpers.h"
+#include "PyTschirpMidiSender.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace py = pybind11;
+
+static double const kPi = 3.14159265358979323846;
+
+static void valueRange(PyTschirpParameterIndex::Handle const &handle, int &minValue, int &maxValue)
+{
+	// The vector parameters of midikraft implement the int capability as well for the range of their elements
+	auto const &caps = handle.capabilities();
+	minValue = caps.intParam ? caps.intParam->minValue() : 0;
+	maxValue = caps.intParam ? caps.intParam->maxValue() : 127;
+}
+
+static int clampedValue(double value, int minValue, int maxValue)
+{
+	return std::max(minValue, std::min(maxValue, (int)std::lround(value)));
+}
+
+PyTschirpAutomation::PyTschirpAutomation(PyTschirp const &patch, double tickRate) : patch_(patch.clone()), running_(false)
+{
+	if (!(tickRate > 0.0 && tickRate <= 10000.0)) {
+		throw std::runtime_error("PyTschirp: Tick rate of an automation must be between 0 and 10000 per second");
+	}
+	if (!patch_.synthPtr()) {
+		throw std::runtime_error("PyTschirp: Only patches of a synth can be automated");
+	}
+	index_ = PyTschirpParameterIndex::forPatch(patch_.patchPtr());
+	tick_ = std::chrono::nanoseconds((int64_t)std::llround(1e9 / tickRate));
+}
+
+PyTschirpAutomation::~PyTschirpAutomation()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock_);
+		stopRequested_ = true;
+	}
+	wakeUp_.notify_all();
+	if (thread_.joinable()) {
+		thread_.join();
+	}
+}
+
+void PyTschirpAutomation::breakpoints(std::string const &name, std::vector<std::pair<double, double>> const &points, bool loop)
+{
+	auto handle = handleByName(name);
+	if (handle->capabilities().isVector) {
+		throw std::runtime_error("PyTschirp: Curves can only automate single value parameters, not " + name);
+	}
+	if (points.empty()) {
+		throw std::runtime_error("PyTschirp: A breakpoint curve needs at least one point");
+	}
+	auto sorted = points;
+	std::stable_sort(sorted.begin(), sorted.end(), [](std::pair<double, double> const &a, std::pair<double, double> const &b) { return a.first < b.first; });
+	double length = sorted.back().first;
+	bool looping = loop && length > 0.0;
+
+	int minValue, maxValue;
+	valueRange(*handle, minValue, maxValue);
+	addLane({ handle, looping ? 0.0 : std::max(length, 0.0), [sorted, looping, length, minValue, maxValue](double seconds) {
+		double t = looping ? std::fmod(seconds, length) : seconds;
+		auto next = std::upper_bound(sorted.cbegin(), sorted.cend(), t, [](double time, std::pair<double, double> const &point) { return time < point.first; });
+		double value;
+		if (next == sorted.cbegin()) {
+			value = next->second;
+		}
+		else if (next == sorted.cend()) {
+			value = sorted.back().second;
+		}
+		else {
+			auto previous = next - 1;
+			value = previous->second + (next->second - previous->second) * (t - previous->first) / (next->first - previous->first);
+		}
+		return std::vector<int>({ clampedValue(value, minValue, maxValue) });
+	} });
+}
+
+void PyTschirpAutomation::lfo(std::string const &name, std::string const &shape, double frequency, double low, double high, double phase, double duration)
+{
+	auto handle = handleByName(name);
+	if (handle->capabilities().isVector) {
+		throw std::runtime_error("PyTschirp: Curves can only automate single value parameters, not " + name);
+	}
+	std::function<double(double)> waveform; // One cycle from 0 to 1, values from 0 to 1
+	if (shape == "sine") {
+		waveform = [](double x) { return 0.5 + 0.5 * std::sin(2.0 * kPi * x); };
+	}
+	else if (shape == "triangle") {
+		waveform = [](double x) { return x < 0.5 ? 2.0 * x : 2.0 - 2.0 * x; };
+	}
+	else if (shape == "saw") {
+		waveform = [](double x) { return x; };
+	}
+	else if (shape == "square") {
+		waveform = [](double x) { return x < 0.5 ? 1.0 : 0.0; };
+	}
+	else if (shape != "random") {
+		throw std::runtime_error("PyTschirp: Unknown LFO shape " + shape + ", use sine, triangle, saw, square or random");
+	}
+
+	int minValue, maxValue;
+	valueRange(*handle, minValue, maxValue);
+	addLane({ handle, std::max(duration, 0.0), [waveform, frequency, low, high, phase, minValue, maxValue](double seconds) {
+		double cycles = phase + seconds * frequency;
+		double x = cycles - std::floor(cycles);
+		// Sample and hold, a new value for every cycle
+		double level = waveform ? waveform(x) : (splitMix64((uint64_t)(int64_t)std::floor(cycles)) >> 11) * (1.0 / 9007199254740992.0);
+		return std::vector<int>({ clampedValue(low + (high - low) * level, minValue, maxValue) });
+	} });
+}
+
+void PyTschirpAutomation::morph(PyTschirp const &target, double duration)
+{
+	if (running()) {
+		// Checked before reading the values of patch_, which the thread writes
+		throw std::runtime_error("PyTschirp: Can't change the curves of a running automation, stop() it first");
+	}
+	if (PyTschirpParameterIndex::forPatch(target.patchPtr()) != index_) {
+		throw std::runtime_error("PyTschirp: Can only morph to a patch of the same type");
+	}
+	if (!(duration > 0.0)) {
+		throw std::runtime_error("PyTschirp: Duration of a morph must be greater than 0");
+	}
+
+	auto from = patch_.patchPtr();
+	auto to = target.patchPtr();
+	for (auto handle : index_->patchHandles()) {
+		auto const &caps = handle->capabilities();
+		if (!caps.liveEdit) {
+			continue;
+		}
+		std::vector<int> valuesFrom, valuesTo;
+		if (caps.isVector) {
+			if (!caps.vectorParam || !handle->valueInPatch(*from, valuesFrom) || !handle->valueInPatch(*to, valuesTo)) {
+				continue;
+			}
+			size_t elements = std::min(valuesFrom.size(), valuesTo.size());
+			valuesFrom.resize(elements);
+			valuesTo.resize(elements);
+		}
+		else {
+			int valueFrom, valueTo;
+			if (!caps.intParam || !handle->valueInPatch(*from, valueFrom) || !handle->valueInPatch(*to, valueTo)) {
+				continue;
+			}
+			valuesFrom = { valueFrom };
+			valuesTo = { valueTo };
+		}
+		if (valuesFrom == valuesTo) {
+			continue;
+		}
+
+		// Lookup values have no meaningful order, they switch half way
+		auto type = caps.def->type();
+		bool isLookup = type == midikraft::SynthParameterDefinition::ParamType::LOOKUP || type == midikraft::SynthParameterDefinition::ParamType::LOOKUP_ARRAY;
+		addLane({ handle, duration, [valuesFrom, valuesTo, duration, isLookup](double seconds) {
+			double t = std::min(seconds / duration, 1.0);
+			std::vector<int> values(valuesFrom.size());
+			for (size_t e = 0; e < values.size(); e++) {
+				if (isLookup) {
+					values[e] = t < 0.5 ? valuesFrom[e] : valuesTo[e];
+				}
+				else {
+					values[e] = valuesFrom[e] + (int)std::lround((valuesTo[e] - valuesFrom[e]) * t);
+				}
+			}
+			return values;
+		} });
+	}
+}
+
+void PyTschirpAutomation::clear()
+{
+	if (running()) {
+		throw std::runtime_error("PyTschirp: Can't change the curves of a running automation, stop() it first");
+	}
+	lanes_.clear();
+}
+
+void PyTschirpAutomation::start()
+{
+	if (running()) {
+		throw std::runtime_error("PyTschirp: Automation is already running");
+	}
+	if (lanes_.empty()) {
+		throw std::runtime_error("PyTschirp: Nothing to automate, add a curve first");
+	}
+	if (thread_.joinable()) {
+		thread_.join();
+	}
+	{
+		std::lock_guard<std::mutex> guard(lock_);
+		stopRequested_ = false;
+		error_.clear();
+		ticks_ = 0;
+		lateTicks_ = 0;
+		skippedTicks_ = 0;
+		valuesSent_ = 0;
+		maxLatenessMs_ = 0.0;
+	}
+	running_ = true;
+	thread_ = std::thread(&PyTschirpAutomation::run, this);
+}
+
+void PyTschirpAutomation::stop()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock_);
+		stopRequested_ = true;
+	}
+	wakeUp_.notify_all();
+	if (thread_.joinable()) {
+		thread_.join();
+	}
+	rethrowError();
+}
+
+bool PyTschirpAutomation::running() const
+{
+	return running_;
+}
+
+bool PyTschirpAutomation::wait(int timeoutMs)
+{
+	{
+		std::unique_lock<std::mutex> guard(lock_);
+		auto done = [this]() { return !running_; };
+		if (timeoutMs < 0) {
+			finished_.wait(guard, done);
+		}
+		else if (!finished_.wait_for(guard, std::chrono::milliseconds(timeoutMs), done)) {
+			return false;
+		}
+	}
+	rethrowError();
+	return true;
+}
+
+PyTschirp PyTschirpAutomation::patch() const
+{
+	// A clone, as the thread keeps writing into patch_
+	std::lock_guard<std::mutex> guard(patchLock_);
+	return patch_.clone();
+}
+
+py::dict PyTschirpAutomation::stats()
+{
+	std::lock_guard<std::mutex> guard(lock_);
+	py::dict result;
+	result["running"] = running();
+	result["ticks"] = ticks_;
+	result["lateTicks"] = lateTicks_;
+	result["skippedTicks"] = skippedTicks_;
+	result["maxLatenessMs"] = maxLatenessMs_;
+	result["valuesSent"] = valuesSent_;
+	return result;
+}
+
+void PyTschirpAutomation::addLane(Lane const &lane)
+{
+	if (running()) {
+		throw std::runtime_error("PyTschirp: Can't change the curves of a running automation, stop() it first");
+	}
+	auto existing = std::find_if(lanes_.begin(), lanes_.end(), [&lane](Lane const &l) { return l.handle == lane.handle; });
+	if (existing != lanes_.end()) {
+		*existing = lane;
+	}
+	else {
+		lanes_.push_back(lane);
+	}
+}
+
+PyTschirpParameterIndex::Handle const *PyTschirpAutomation::handleByName(std::string const &name) const
+{
+	auto handle = patch_.attributeHandle(name);
+	if (!handle) {
+		throw std::runtime_error("PyTschirp: Unknown parameter name " + name);
+	}
+	if (!handle->capabilities().liveEdit) {
+		throw std::runtime_error("PyTschirp: Parameter " + name + " can't be live edited, so it can't be automated");
+	}
+	if (!handle->capabilities().intParam) {
+		throw std::runtime_error("PyTschirp: Parameter " + name + " has no range, so it can't be automated");
+	}
+	return handle;
+}
+
+void PyTschirpAutomation::rethrowError()
+{
+	// Reported only once, by whichever of stop() and wait() comes first
+	std::string error;
+	{
+		std::lock_guard<std::mutex> guard(lock_);
+		error.swap(error_);
+	}
+	if (!error.empty()) {
+		throw std::runtime_error(error);
+	}
+}
+
+void PyTschirpAutomation::run()
+{
+	std::vector<std::vector<int>> sent(lanes_.size());
+	try {
+		// The values are sent from this thread, live edits queued before must not arrive after them
+		auto synth = patch_.synthPtr();
+		if (synth) {
+			PyTschirpMidiSender::forSynth(synth)->flush();
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		for (uint64 tick = 0; ; tick++) {
+			auto due = start + tick_ * (int64_t)tick;
+			{
+				std::unique_lock<std::mutex> guard(lock_);
+				if (wakeUp_.wait_until(guard, due, [this]() { return stopRequested_; })) {
+					break;
+				}
+			}
+			auto now = std::chrono::steady_clock::now();
+			uint64 skipped = 0;
+			if (now - due >= tick_) {
+				// Missed ticks are not replayed in a burst, the thread continues with the last tick that is due
+				uint64 current = (uint64)((now - start) / tick_);
+				skipped = current - tick;
+				tick = current;
+				due = start + tick_ * (int64_t)tick;
+			}
+			auto lateness = now - due;
+
+			// The curves are evaluated at the time the tick was due, so a late tick doesn't distort them
+			double seconds = std::chrono::duration<double>(due - start).count();
+			std::vector<std::pair<PyTschirpParameterIndex::Handle const *, std::vector<int>>> values;
+			bool finished = true;
+			for (size_t i = 0; i < lanes_.size(); i++) {
+				auto const &lane = lanes_[i];
+				bool endless = lane.duration <= 0.0;
+				if (endless || seconds < lane.duration) {
+					finished = false;
+				}
+				auto value = lane.value(endless ? seconds : std::min(seconds, lane.duration));
+				if (value != sent[i]) {
+					values.push_back({ lane.handle, value });
+					sent[i] = value;
+				}
+			}
+			if (!values.empty()) {
+				// Sent right here, the synth's sender would pace and coalesce them away from the time of the tick
+				std::lock_guard<std::mutex> guard(patchLock_);
+				patch_.updateHandles(values, true);
+			}
+
+			{
+				std::lock_guard<std::mutex> guard(lock_);
+				ticks_++;
+				if (skipped > 0) {
+					lateTicks_++;
+					skippedTicks_ += skipped;
+				}
+				maxLatenessMs_ = std::max(maxLatenessMs_, std::chrono::duration<double, std::milli>(lateness).count());
+				valuesSent_ += values.size();
+			}
+			if (finished) {
+				break;
+			}
+		}
+	}
+	catch (std::exception &e) {
+		std::lock_guard<std::mutex> guard(lock_);
+		error_ = e.what();
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(lock_);
+		running_ = false;
+	}
+	finished_.notify_all();
+}
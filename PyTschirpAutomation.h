@@ -0,0 +1,85 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "Patch.h"
+
+#ifdef _MSC_VER
+#pragma warning ( push )
+#pragma warning ( disable: 4100 )
+#endif
+#include <pybind11/pybind11.h>
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+#include "PyTschirpPatch.h"
+#include "PyTschirpParameterIndex.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Plays parameter curves into a live synth from a background thread, so neither the timing nor the interpreter depend on each other.
+// The thread ticks at a fixed rate against absolute deadlines, evaluates all curves at the time the tick was due, writes the values that
+// changed since the last tick into the patch and sends them right away as one block of live edits. A tick that is late by a full tick or more
+// skips the ticks missed instead of catching up with them.
+// The automation works on its own clone of the patch given
+class PyTschirpAutomation {
+public:
+	PyTschirpAutomation(PyTschirp const &patch, double tickRate);
+	~PyTschirpAutomation();
+
+	// Curves can only be changed while stopped, a new curve for a parameter replaces the old one. All values are rounded and clamped to
+	// the range of the parameter. Names are resolved like attribute names, so the curves of a layer view go to that layer
+	void breakpoints(std::string const &name, std::vector<std::pair<double, double>> const &points, bool loop); // (seconds, value) pairs
+	void lfo(std::string const &name, std::string const &shape, double frequency, double low, double high, double phase, double duration);
+	void morph(PyTschirp const &target, double duration); // Every parameter that can be live edited, from its current value to the target's
+	void clear();
+
+	void start(); // Returns immediately, the curves start at 0 seconds
+	void stop(); // Blocks until the thread has stopped
+	bool running() const;
+	bool wait(int timeoutMs); // Blocks until all curves have ended, returns false on timeout, -1 waits forever. Endless curves only end with stop()
+
+	PyTschirp patch() const; // A clone of the automated patch, with the values sent last
+	pybind11::dict stats();
+
+private:
+	struct Lane {
+		PyTschirpParameterIndex::Handle const *handle; // Owned by index_
+		double duration; // Seconds, 0 for endless
+		std::function<std::vector<int>(double seconds)> value;
+	};
+
+	void addLane(Lane const &lane);
+	PyTschirpParameterIndex::Handle const *handleByName(std::string const &name) const;
+	void rethrowError();
+	void run();
+
+	PyTschirp patch_;
+	mutable std::mutex patchLock_; // The thread writes into patch_ while patch() clones it
+	std::shared_ptr<PyTschirpParameterIndex> index_;
+	std::chrono::nanoseconds tick_;
+	std::vector<Lane> lanes_;
+	std::thread thread_;
+	std::atomic<bool> running_;
+
+	std::mutex lock_;
+	std::condition_variable wakeUp_;
+	std::condition_variable finished_;
+	bool stopRequested_ = false;
+	std::string error_; // What the thread failed with, rethrown by stop() and wait()
+	uint64 ticks_ = 0;
+	uint64 lateTicks_ = 0; // Ticks that started a full tick or more after they were due
+	uint64 skippedTicks_ = 0; // Ticks missed by the late ones
+	uint64 valuesSent_ = 0;
+	double maxLatenessMs_ = 0.0;
+};
@@ -0,0 +1,215 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "PyTschirpDetection.h"
+
+#include "PyTschirpSynthCapabilities.h"
+
+#include <algorithm>
+#include <iostream>
+
+PyTschirpDetection::PyTschirpDetection(std::shared_ptr<midikraft::Synth> synth) : synth_(synth)
+{
+	device_ = std::dynamic_pointer_cast<midikraft::SimpleDiscoverableDevice>(synth);
+	if (!device_) {
+		throw std::runtime_error("PyTschirp: Synth does not support auto detection");
+	}
+	midikraft::MidiController::instance()->addMessageHandler(handler_, [this](MidiInput *source, MidiMessage const &message) {
+		if (!source || !message.isSysEx()) return;
+		auto channel = device_->channelIfValidDeviceResponse(message);
+		if (channel.isValid()) {
+			std::lock_guard<std::mutex> guard(lock_);
+			replies_.push_back({ source->getDeviceInfo(), channel });
+			replyReceived_.notify_all();
+		}
+	});
+}
+
+PyTschirpDetection::~PyTschirpDetection()
+{
+	midikraft::MidiController::instance()->removeMessageHandler(handler_);
+}
+
+bool PyTschirpDetection::detect(bool useCache, int timeoutMs)
+{
+	// One deadline for everything. The cached location gets at most half of the time, so a stale cache still leaves time for the scan
+	auto start = Time::getCurrentTime();
+	auto deadline = start + RelativeTime::milliseconds(timeoutMs);
+	if (useCache && probeCachedLocation(start + RelativeTime::milliseconds(timeoutMs / 2))) {
+		return true;
+	}
+	return scanAllPorts(deadline);
+}
+
+File PyTschirpDetection::cacheFile()
+{
+	return File::getSpecialLocation(File::userApplicationDataDirectory).getChildFile("PyTschirp").getChildFile("detection-cache.json");
+}
+
+bool PyTschirpDetection::probeCachedLocation(juce::Time deadline)
+{
+	auto cache = JSON::parse(cacheFile());
+	auto entry = cache.getProperty(Identifier(synth_->getName()), var());
+	if (!entry.isObject()) {
+		return false;
+	}
+
+	// Only try if both devices are still there
+	String inputId = entry.getProperty("input", "");
+	String outputId = entry.getProperty("output", "");
+	auto inputs = MidiInput::getAvailableDevices();
+	auto outputs = MidiOutput::getAvailableDevices();
+	auto input = std::find_if(inputs.begin(), inputs.end(), [&](juce::MidiDeviceInfo const &info) { return info.identifier == inputId; });
+	auto output = std::find_if(outputs.begin(), outputs.end(), [&](juce::MidiDeviceInfo const &info) { return info.identifier == outputId; });
+	if (input == inputs.end() || output == outputs.end()) {
+		return false;
+	}
+
+	midikraft::MidiController::instance()->enableMidiInput(*input);
+	clearReplies();
+	int channel = entry.getProperty("channel", 0);
+	sendDetectMessages({ *output }, device_->deviceDetect(channel));
+
+	Reply reply{ juce::MidiDeviceInfo(), MidiChannel::invalidChannel() };
+	while (waitForReply(deadline, remainingMs(deadline), reply)) {
+		if (reply.input.identifier == input->identifier) {
+			device_->setCurrentChannelZeroBased(*input, *output, reply.channel.toZeroBasedInt());
+			PyTschirpSynthCapabilities::forSynth(synth_)->invalidateLocation();
+			return true;
+		}
+	}
+	return false;
+}
+
+bool PyTschirpDetection::scanAllPorts(juce::Time deadline)
+{
+	for (auto const &input : MidiInput::getAvailableDevices()) {
+		midikraft::MidiController::instance()->enableMidiInput(input);
+	}
+	std::vector<juce::MidiDeviceInfo> candidates;
+	for (auto const &output : MidiOutput::getAvailableDevices()) {
+		candidates.push_back(output);
+	}
+
+	std::vector<MidiMessage> detectMessages;
+	int channels = device_->needsChannelSpecificDetection() ? 16 : 1;
+	for (int channel = 0; channel < channels; channel++) {
+		auto messages = device_->deviceDetect(channel);
+		std::copy(messages.cbegin(), messages.cend(), std::back_inserter(detectMessages));
+	}
+
+	// Probe all outputs at once, which tells us the input and the channel
+	clearReplies();
+	sendDetectMessages(candidates, detectMessages);
+	Reply found{ juce::MidiDeviceInfo(), MidiChannel::invalidChannel() };
+	if (!waitForReply(deadline, remainingMs(deadline), found)) {
+		return false;
+	}
+
+	// Now narrow down the output, every round only sends to half of the remaining candidates
+	int roundTimeoutMs = std::max(device_->deviceDetectSleepMS(), 50);
+	while (candidates.size() > 1) {
+		std::vector<juce::MidiDeviceInfo> firstHalf(candidates.begin(), candidates.begin() + candidates.size() / 2);
+		// Give late replies of the previous round a chance to arrive, so they are not mistaken for replies to this round
+		Thread::sleep(roundTimeoutMs / 4);
+		clearReplies();
+		sendDetectMessages(firstHalf, detectMessages);
+		bool replyFromFirstHalf = false;
+		Reply reply{ juce::MidiDeviceInfo(), MidiChannel::invalidChannel() };
+		while (waitForReply(deadline, roundTimeoutMs, reply)) {
+			if (reply.input.identifier == found.input.identifier) {
+				replyFromFirstHalf = true;
+				break;
+			}
+		}
+		if (replyFromFirstHalf) {
+			candidates = firstHalf;
+		}
+		else {
+			if (Time::getCurrentTime() > deadline) {
+				return false;
+			}
+			candidates.erase(candidates.begin(), candidates.begin() + candidates.size() / 2);
+		}
+	}
+	if (candidates.empty()) {
+		return false;
+	}
+
+	// A round without a reply only means the reply didn't arrive in time, so the output found must answer before it is used and cached
+	Thread::sleep(roundTimeoutMs / 4);
+	clearReplies();
+	sendDetectMessages({ candidates[0] }, device_->deviceDetect(found.channel.toZeroBasedInt()));
+	bool confirmed = false;
+	Reply reply{ juce::MidiDeviceInfo(), MidiChannel::invalidChannel() };
+	while (waitForReply(deadline, remainingMs(deadline), reply)) {
+		if (reply.input.identifier == found.input.identifier) {
+			confirmed = true;
+			break;
+		}
+	}
+	if (!confirmed) {
+		return false;
+	}
+
+	device_->setCurrentChannelZeroBased(found.input, candidates[0], found.channel.toZeroBasedInt());
+	PyTschirpSynthCapabilities::forSynth(synth_)->invalidateLocation();
+	saveLocation(found.input, candidates[0], found.channel);
+	return true;
+}
+
+void PyTschirpDetection::saveLocation(juce::MidiDeviceInfo const &input, juce::MidiDeviceInfo const &output, MidiChannel channel)
+{
+	auto file = cacheFile();
+	auto cache = JSON::parse(file);
+	if (!cache.isObject()) {
+		cache = var(new DynamicObject());
+	}
+	auto entry = var(new DynamicObject());
+	entry.getDynamicObject()->setProperty("input", input.identifier);
+	entry.getDynamicObject()->setProperty("output", output.identifier);
+	entry.getDynamicObject()->setProperty("channel", channel.toZeroBasedInt());
+	cache.getDynamicObject()->setProperty(Identifier(synth_->getName()), entry);
+
+	file.getParentDirectory().createDirectory();
+	if (!file.replaceWithText(JSON::toString(cache))) {
+		std::cerr << "PyTschirp: Failed to write detection cache to " << file.getFullPathName() << std::endl;
+	}
+}
+
+void PyTschirpDetection::sendDetectMessages(std::vector<juce::MidiDeviceInfo> const &outputs, std::vector<MidiMessage> const &messages)
+{
+	for (auto const &output : outputs) {
+		midikraft::MidiController::instance()->getMidiOutput(output)->sendBlockOfMessagesNow(messages);
+	}
+}
+
+bool PyTschirpDetection::waitForReply(juce::Time deadline, int maxWaitMs, Reply &replyOut)
+{
+	auto now = Time::getCurrentTime();
+	auto waitMs = std::min((int64)maxWaitMs, (deadline - now).inMilliseconds());
+	std::unique_lock<std::mutex> guard(lock_);
+	if (replies_.empty() && waitMs > 0) {
+		replyReceived_.wait_for(guard, std::chrono::milliseconds(waitMs), [this]() { return !replies_.empty(); });
+	}
+	if (replies_.empty()) {
+		return false;
+	}
+	replyOut = replies_.front();
+	replies_.erase(replies_.begin());
+	return true;
+}
+
+int PyTschirpDetection::remainingMs(juce::Time deadline)
+{
+	return (int)std::max((int64)0, (deadline - Time::getCurrentTime()).inMilliseconds());
+}
+
+void PyTschirpDetection::clearReplies()
+{
+	std::lock_guard<std::mutex> guard(lock_);
+	replies_.clear();
+}
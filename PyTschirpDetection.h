@@ -0,0 +1,50 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "Synth.h"
+#include "SimpleDiscoverableDevice.h"
+#include "MidiController.h"
+
+#include <condition_variable>
+#include <mutex>
+
+// Finds the MIDI ports and channel of a synth. The last successful location is kept in a small cache file, and is tried first
+// with a single probe. Only if that fails, all outputs are probed at the same time, and the output the synth is connected to
+// is then found by bisecting the output list. The output found is confirmed with one more probe before it is used and cached.
+class PyTschirpDetection {
+public:
+	PyTschirpDetection(std::shared_ptr<midikraft::Synth> synth);
+	~PyTschirpDetection();
+
+	bool detect(bool useCache, int timeoutMs);
+
+	static File cacheFile();
+
+private:
+	struct Reply {
+		juce::MidiDeviceInfo input;
+		MidiChannel channel;
+	};
+
+	// Both stop waiting at the deadline
+	bool probeCachedLocation(juce::Time deadline);
+	bool scanAllPorts(juce::Time deadline);
+	void saveLocation(juce::MidiDeviceInfo const &input, juce::MidiDeviceInfo const &output, MidiChannel channel);
+
+	void sendDetectMessages(std::vector<juce::MidiDeviceInfo> const &outputs, std::vector<MidiMessage> const &messages);
+	bool waitForReply(juce::Time deadline, int maxWaitMs, Reply &replyOut);
+	void clearReplies();
+	static int remainingMs(juce::Time deadline);
+
+	std::shared_ptr<midikraft::Synth> synth_;
+	std::shared_ptr<midikraft::SimpleDiscoverableDevice> device_;
+	midikraft::MidiController::HandlerHandle handler_ = midikraft::MidiController::makeOneHandle();
+	std::mutex lock_;
+	std::condition_variable replyReceived_;
+	std::vector<Reply> replies_;
+};
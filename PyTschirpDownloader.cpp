@@ -0,0 +1,132 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "PyTschirpDownloader.h"
+
+#include "PyTschirpStats.h"
+#include "PyTschirpHelpers.h"
+
+#include "Capability.h"
+
+#include <chrono>
+#include <deque>
+#include <map>
+
+PyTschirpDownloader::PyTschirpDownloader(std::shared_ptr<midikraft::Synth> synth, juce::MidiDeviceInfo const &input, juce::MidiDeviceInfo const &output) :
+	synth_(synth), input_(input), output_(output)
+{
+	programDump_ = midikraft::Capability::hasCapability<midikraft::ProgramDumpCabability>(synth_);
+	if (!programDump_) {
+		throw std::runtime_error("PyTschirp: Synth has not implemented the ProgramDumpCapability, can't download programs");
+	}
+	auto programDump = programDump_;
+	// The capability can't tell the number of messages of a program dump, the reassembler learns it from the first one
+	reassembler_ = std::make_unique<PyTschirpSysexReassembler>([programDump](std::vector<MidiMessage> const &messages) {
+		return programDump->isSingleProgramDump(messages);
+	});
+	midikraft::MidiController::instance()->addMessageHandler(handler_, [this](MidiInput *source, MidiMessage const &message) {
+		if (!source || source->getIdentifier() != input_.identifier) return;
+		// Program dumps can consist of more than one message
+		if (reassembler_->add(message)) {
+			auto messages = reassembler_->takeComplete();
+			int program = programDump_->getProgramNumber(messages).toZeroBased();
+			std::lock_guard<std::mutex> guard(lock_);
+			replies_.push_back({ program, messages });
+			replyReceived_.notify_one();
+		}
+	});
+}
+
+PyTschirpDownloader::~PyTschirpDownloader()
+{
+	midikraft::MidiController::instance()->removeMessageHandler(handler_);
+}
+
+std::vector<std::shared_ptr<midikraft::Patch>> PyTschirpDownloader::download(std::vector<int> const &programs, Options const &options, std::function<void(int, int)> progress)
+{
+	typedef std::chrono::steady_clock Clock;
+	struct Outstanding {
+		Clock::time_point sent;
+		int attempts;
+	};
+
+	std::map<int, size_t> resultIndex;
+	for (size_t i = 0; i < programs.size(); i++) {
+		if (!resultIndex.emplace(programs[i], i).second) {
+			throw std::runtime_error("PyTschirp: Program " + std::to_string(programs[i]) + " requested more than once");
+		}
+	}
+	std::vector<std::shared_ptr<midikraft::Patch>> result(programs.size());
+	std::deque<int> todo(programs.cbegin(), programs.cend());
+	std::map<int, Outstanding> outstanding;
+	std::map<int, int> attempts;
+	auto timeout = std::chrono::milliseconds(options.timeoutMs);
+	int done = 0;
+
+	while (done < (int)programs.size()) {
+		// Keep the pipeline filled
+		while ((int)outstanding.size() < std::max(1, options.inFlight) && !todo.empty()) {
+			int program = todo.front();
+			todo.pop_front();
+			auto request = programDump_->requestPatch(program);
+			synth_->sendBlockOfMessagesToSynth(output_, request);
+			PyTschirpStats::countSent(synth_->getName(), request.size(), byteCount(request));
+			outstanding[program] = { Clock::now(), ++attempts[program] };
+		}
+
+		// Wait for the next reply or the earliest timeout
+		auto earliest = outstanding.begin()->second.sent;
+		for (auto const &o : outstanding) {
+			earliest = std::min(earliest, o.second.sent);
+		}
+		std::vector<Reply> replies;
+		{
+			std::unique_lock<std::mutex> guard(lock_);
+			replyReceived_.wait_until(guard, earliest + timeout, [this]() { return !replies_.empty(); });
+			replies.swap(replies_);
+		}
+
+		for (auto const &reply : replies) {
+			auto found = outstanding.find(reply.program);
+			if (found == outstanding.end()) {
+				// Not requested, or a late reply to a request we retried already and got an answer for
+				continue;
+			}
+			if (PyTschirpStats::enabled()) {
+				PyTschirpStats::recordLatency(PyTschirpStats::REPLY_ROUND_TRIP, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - found->second.sent).count());
+			}
+			outstanding.erase(found);
+			std::shared_ptr<midikraft::Patch> patch;
+			{
+				PyTschirpStats::ScopedTimer timer(PyTschirpStats::SYSEX_PARSE);
+				patch = std::dynamic_pointer_cast<midikraft::Patch>(programDump_->patchFromProgramDumpSysex(reply.messages));
+			}
+			if (!patch) {
+				throw std::runtime_error("PyTschirp: Failed to parse program dump for program " + std::to_string(reply.program));
+			}
+			result[resultIndex[reply.program]] = patch;
+			done++;
+			if (progress) {
+				progress(done, (int)programs.size());
+			}
+		}
+
+		auto now = Clock::now();
+		for (auto it = outstanding.begin(); it != outstanding.end(); ) {
+			if (now - it->second.sent >= timeout) {
+				if (it->second.attempts > options.retries) {
+					throw std::runtime_error("PyTschirp: Synth did not reply to request for program " + std::to_string(it->first));
+				}
+				todo.push_front(it->first);
+				it = outstanding.erase(it);
+			}
+			else {
+				++it;
+			}
+		}
+	}
+	return result;
+}
@@ -0,0 +1,50 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "Synth.h"
+#include "Patch.h"
+#include "ProgramDumpCapability.h"
+#include "MidiController.h"
+
+#include "PyTschirpSysexReassembler.h"
+
+#include <condition_variable>
+#include <mutex>
+
+// Downloads programs from the synth with more than one request in flight. Replies are matched to the requests by their
+// program number, so they may arrive in any order, and requests without reply are retried after a timeout.
+class PyTschirpDownloader {
+public:
+	struct Options {
+		int inFlight;
+		int timeoutMs;
+		int retries;
+	};
+
+	PyTschirpDownloader(std::shared_ptr<midikraft::Synth> synth, juce::MidiDeviceInfo const &input, juce::MidiDeviceInfo const &output);
+	~PyTschirpDownloader();
+
+	// progress(done, total) is called on the calling thread. The result is in the order of the programs requested
+	std::vector<std::shared_ptr<midikraft::Patch>> download(std::vector<int> const &programs, Options const &options, std::function<void(int, int)> progress);
+
+private:
+	struct Reply {
+		int program;
+		std::vector<MidiMessage> messages;
+	};
+
+	std::shared_ptr<midikraft::Synth> synth_;
+	std::shared_ptr<midikraft::ProgramDumpCabability> programDump_;
+	juce::MidiDeviceInfo input_;
+	juce::MidiDeviceInfo output_;
+	midikraft::MidiController::HandlerHandle handler_ = midikraft::MidiController::makeOneHandle();
+	std::mutex lock_;
+	std::condition_variable replyReceived_;
+	std::vector<Reply> replies_;
+	std::unique_ptr<PyTschirpSysexReassembler> reassembler_; // Only used on the MIDI thread
+};
@@ -0,0 +1,135 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "PyTschirpFingerprint.h"
+
+#include "PyTschirpParameterIndex.h"
+#include "PyTschirpParallel.h"
+#include "PyTschirpHelpers.h"
+
+#include <cstdio>
+#include <unordered_map>
+
+namespace {
+
+	// Two independent 64 bit lanes, each value is mixed in with the splitmix64 finalizer
+	class Hasher {
+	public:
+		void add(uint64_t value) {
+			a_ = splitMix64(a_ ^ value);
+			b_ = splitMix64(b_ + value * 0x9e3779b97f4a7c15ull);
+			count_++;
+		}
+
+		void add(char const *bytes, size_t length) {
+			for (size_t i = 0; i < length; i++) {
+				add((uint64_t)(uint8_t)bytes[i]);
+			}
+		}
+
+		PyTschirpFingerprint result() const {
+			return { splitMix64(a_ ^ count_), splitMix64(b_ + count_) };
+		}
+
+	private:
+		uint64_t a_ = 0x243f6a8885a308d3ull;
+		uint64_t b_ = 0x13198a2e03707344ull;
+		uint64_t count_ = 0;
+	};
+
+}
+
+PyTschirpFingerprint PyTschirpFingerprint::forPatch(std::shared_ptr<midikraft::Patch> const &patch, std::string const &synthName)
+{
+	Hasher hasher;
+	// Patches of different synths must never be equal, even if their values happen to be
+	hasher.add(synthName.data(), synthName.size());
+	hasher.add(synthName.size());
+
+	auto index = PyTschirpParameterIndex::forPatch(patch);
+	if (index->definitions().empty()) {
+		auto const &data = patch->data();
+		hasher.add(reinterpret_cast<char const *>(data.data()), data.size());
+		return hasher.result();
+	}
+
+	std::vector<int> vectorValue;
+	for (auto handle : index->patchHandles()) {
+		auto const &caps = handle->capabilities();
+		if (caps.isVector) {
+			vectorValue.clear();
+			if (caps.vectorParam && handle->valueInPatch(*patch, vectorValue)) {
+				hasher.add(vectorValue.size());
+				for (int value : vectorValue) {
+					hasher.add((uint64_t)(int64_t)value);
+				}
+				continue;
+			}
+		}
+		else {
+			int value;
+			if (caps.intParam && handle->valueInPatch(*patch, value)) {
+				hasher.add((uint64_t)(int64_t)value);
+				continue;
+			}
+		}
+		// Keep the position of the following values, a value that can't be read must not shift them
+		hasher.add(0xffffffffffffffffull);
+	}
+	return hasher.result();
+}
+
+std::string PyTschirpFingerprint::toString() const
+{
+	char buffer[33];
+	snprintf(buffer, sizeof(buffer), "%016llx%016llx", (unsigned long long) high, (unsigned long long) low);
+	return buffer;
+}
+
+bool PyTschirpFingerprint::operator==(PyTschirpFingerprint const &other) const
+{
+	return high == other.high && low == other.low;
+}
+
+bool PyTschirpFingerprint::operator!=(PyTschirpFingerprint const &other) const
+{
+	return !(*this == other);
+}
+
+size_t PyTschirpFingerprint::Hash::operator()(PyTschirpFingerprint const &fingerprint) const
+{
+	return (size_t)(fingerprint.low ^ (fingerprint.high * 0x9e3779b97f4a7c15ull));
+}
+
+PyTschirpDedupe PyTschirpDedupe::run(std::vector<std::shared_ptr<midikraft::Patch>> const &patches, std::vector<std::string> const &synthNames, int threads)
+{
+	std::vector<PyTschirpFingerprint> fingerprints(patches.size());
+	parallelForEach((int)patches.size(), threads, [&patches, &synthNames, &fingerprints](int index) {
+		fingerprints[index] = PyTschirpFingerprint::forPatch(patches[index], synthNames[index]);
+	});
+
+	// Single pass, the group index is the position in unique
+	PyTschirpDedupe result;
+	std::unordered_map<PyTschirpFingerprint, int, PyTschirpFingerprint::Hash> groupOf;
+	groupOf.reserve(patches.size());
+	std::vector<std::vector<int>> groups;
+	for (int i = 0; i < (int)patches.size(); i++) {
+		auto inserted = groupOf.emplace(fingerprints[i], (int)groups.size());
+		if (inserted.second) {
+			groups.push_back({ i });
+			result.unique.push_back(i);
+		}
+		else {
+			groups[inserted.first->second].push_back(i);
+		}
+	}
+	for (auto &group : groups) {
+		if (group.size() > 1) {
+			result.duplicates.push_back(std::move(group));
+		}
+	}
+	return result;
+}
@@ -0,0 +1,44 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "Patch.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// 128 bit content hash of a patch. It is computed from the decoded parameter values, so two patches that only differ in their name
+// or in unused bytes of the sysex get the same fingerprint. Patches without parameter definitions are hashed from their raw data.
+// Only portable values go into the hash, so the same patch gets the same fingerprint with every compiler and platform
+struct PyTschirpFingerprint {
+	static const uint32_t kVersion = 2; // Stored with persisted fingerprints, increase it whenever the hash of a patch changes
+
+	uint64_t high;
+	uint64_t low;
+
+	// The synth name keeps the patches of different synths apart, it is empty for patches without a synth
+	static PyTschirpFingerprint forPatch(std::shared_ptr<midikraft::Patch> const &patch, std::string const &synthName);
+
+	std::string toString() const; // 32 hex digits
+
+	bool operator==(PyTschirpFingerprint const &other) const;
+	bool operator!=(PyTschirpFingerprint const &other) const;
+
+	struct Hash {
+		size_t operator()(PyTschirpFingerprint const &fingerprint) const;
+	};
+};
+
+// Groups a list of patches by fingerprint in one pass. The fingerprints are computed on a pool of worker threads
+struct PyTschirpDedupe {
+	std::vector<int> unique; // Index of the first patch of each fingerprint, in the order of the input
+	std::vector<std::vector<int>> duplicates; // One group per fingerprint seen more than once, the first entry is the one in unique
+
+	// synthNames has the name of the synth of each patch
+	static PyTschirpDedupe run(std::vector<std::shared_ptr<midikraft::Patch>> const &patches, std::vector<std::string> const &synthNames, int threads);
+};
@@ -0,0 +1,67 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "PyTschirpFuture.h"
+
+#include <thread>
+
+namespace py = pybind11;
+
+py::object runAsFuture(std::function<std::function<py::object()>()> work)
+{
+	auto future = py::module::import("concurrent.futures").attr("Future")();
+	// Marks the future as running, so it can't be cancelled any more from Python
+	future.attr("set_running_or_notify_cancel")();
+
+	// The worker thread gets its own reference, which it must only release while holding the GIL
+	auto futureRef = new py::object(future);
+	std::thread([work, futureRef]() {
+		std::function<py::object()> makeResult;
+		std::string error;
+		try {
+			makeResult = work();
+		}
+		catch (std::exception &e) {
+			error = e.what();
+		}
+		catch (...) {
+			error = "PyTschirp: Unknown error in background operation";
+		}
+
+		if (!Py_IsInitialized()) {
+			// Interpreter is shutting down, nobody is waiting anymore. Leak the reference instead of touching Python
+			return;
+		}
+		py::gil_scoped_acquire acquire;
+		auto runtimeError = py::module::import("builtins").attr("RuntimeError");
+		// Nothing may escape this thread, that would terminate the whole interpreter
+		try {
+			try {
+				if (makeResult) {
+					futureRef->attr("set_result")(makeResult());
+				}
+				else {
+					futureRef->attr("set_exception")(runtimeError(error));
+				}
+			}
+			catch (py::error_already_set &e) {
+				futureRef->attr("set_exception")(e.value());
+			}
+			catch (std::exception &e) {
+				futureRef->attr("set_exception")(runtimeError(e.what()));
+			}
+			catch (...) {
+				futureRef->attr("set_exception")(runtimeError("PyTschirp: Unknown error in background operation"));
+			}
+		}
+		catch (...) {
+			// The future couldn't even take the exception, there is nobody left to tell
+		}
+		delete futureRef;
+	}).detach();
+
+	return future;
+}
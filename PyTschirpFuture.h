@@ -0,0 +1,23 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#ifdef _MSC_VER
+#pragma warning ( push )
+#pragma warning ( disable: 4100 )
+#endif
+#include <pybind11/pybind11.h>
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+#include <functional>
+
+// Runs work on a background thread without holding the GIL, and returns a concurrent.futures.Future for it (use asyncio.wrap_future() to await it).
+// The function returned by work is then called with the GIL held to convert the result into the Python object the future is completed with.
+// Exceptions thrown by work complete the future with a RuntimeError.
+pybind11::object runAsFuture(std::function<std::function<pybind11::object()>()> work);
@@ -0,0 +1,33 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include <cstdint>
+#include <vector>
+
+// splitmix64 finalizer, turns neighbouring numbers into well spread, independent looking 64 bit values
+inline uint64_t splitMix64(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ull;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebull;
+	x ^= x >> 31;
+	return x;
+}
+
+// Number of bytes the messages take on the wire
+inline size_t byteCount(std::vector<MidiMessage> const &messages)
+{
+	size_t result = 0;
+	for (auto const &message : messages) {
+		result += (size_t)message.getRawDataSize();
+	}
+	return result;
+}
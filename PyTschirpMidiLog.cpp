@@ -0,0 +1,208 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "PyTschirpMidiLog.h"
+
+#include <chrono>
+#include <iostream>
+
+PyTschirpMidiLog & PyTschirpMidiLog::instance()
+{
+	static PyTschirpMidiLog log;
+	return log;
+}
+
+PyTschirpMidiLog::PyTschirpMidiLog() : enqueuePos_(0), dequeuePos_(0), level_(FULL), dropped_(0), written_(0), accepted_(0), shutdown_(false)
+{
+	records_ = new Record[kCapacity];
+	for (size_t i = 0; i < kCapacity; i++) {
+		records_[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	drainer_ = std::thread(&PyTschirpMidiLog::drain, this);
+}
+
+PyTschirpMidiLog::~PyTschirpMidiLog()
+{
+	shutdown_ = true;
+	drainer_.join();
+	delete[] records_;
+}
+
+void PyTschirpMidiLog::log(MidiMessage const &message, bool isOut)
+{
+	if (level_.load(std::memory_order_relaxed) == OFF) {
+		return;
+	}
+
+	// Bounded multi producer queue, see Dmitry Vyukov's MPMC queue. A full queue drops the record instead of blocking the MIDI thread
+	Record *record;
+	size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+	for (;;) {
+		record = &records_[pos & (kCapacity - 1)];
+		size_t sequence = record->sequence.load(std::memory_order_acquire);
+		intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+		if (diff == 0) {
+			if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		}
+		else if (diff < 0) {
+			dropped_.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		else {
+			pos = enqueuePos_.load(std::memory_order_relaxed);
+		}
+	}
+
+	record->timestamp = Time::getMillisecondCounterHiRes();
+	record->isOut = isOut;
+	record->length = message.getRawDataSize();
+	memcpy(record->data, message.getRawData(), (size_t)std::min(record->length, kMaxBytes));
+	accepted_.fetch_add(1, std::memory_order_relaxed);
+	record->sequence.store(pos + 1, std::memory_order_release);
+}
+
+void PyTschirpMidiLog::setLevel(int level)
+{
+	level_ = std::max((int)OFF, std::min(level, (int)FULL));
+}
+
+int PyTschirpMidiLog::level() const
+{
+	return level_;
+}
+
+void PyTschirpMidiLog::setLogFile(std::string const &filename)
+{
+	std::lock_guard<std::mutex> guard(outputLock_);
+	if (file_.is_open()) {
+		file_.close();
+	}
+	if (!filename.empty()) {
+		file_.open(filename, std::ios::out | std::ios::app);
+		if (!file_.is_open()) {
+			throw std::runtime_error("PyTschirp: Failed to open MIDI log file " + filename);
+		}
+	}
+}
+
+void PyTschirpMidiLog::setOutput(std::function<void(std::string const &)> output)
+{
+	std::lock_guard<std::mutex> callGuard(outputCallLock_);
+	std::lock_guard<std::mutex> guard(outputLock_);
+	output_ = output;
+}
+
+void PyTschirpMidiLog::flush()
+{
+	auto target = accepted_.load();
+	while (written_.load() < target) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	std::lock_guard<std::mutex> guard(outputLock_);
+	if (file_.is_open()) file_.flush(); else std::cout.flush();
+}
+
+uint64 PyTschirpMidiLog::droppedRecords() const
+{
+	return dropped_;
+}
+
+const int PyTschirpMidiLog::kMaxBytes; // std::min takes it by reference
+
+void PyTschirpMidiLog::drain()
+{
+	Record record;
+	while (!shutdown_) {
+		// Write in blocks, so an output function that has to wait for the GIL is called only once for all records waiting
+		String lines;
+		uint64 count = 0;
+		while (count < kCapacity && pop(record)) {
+			lines += format(record) + "\n";
+			count++;
+		}
+		if (count > 0) {
+			write(lines);
+			written_.fetch_add(count, std::memory_order_relaxed);
+		}
+		else {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+	}
+}
+
+bool PyTschirpMidiLog::pop(Record &recordOut)
+{
+	Record *record;
+	size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+	for (;;) {
+		record = &records_[pos & (kCapacity - 1)];
+		size_t sequence = record->sequence.load(std::memory_order_acquire);
+		intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+		if (diff == 0) {
+			if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		}
+		else if (diff < 0) {
+			return false;
+		}
+		else {
+			pos = dequeuePos_.load(std::memory_order_relaxed);
+		}
+	}
+	recordOut.timestamp = record->timestamp;
+	recordOut.isOut = record->isOut;
+	recordOut.length = record->length;
+	memcpy(recordOut.data, record->data, (size_t)std::min(record->length, kMaxBytes));
+	record->sequence.store(pos + kCapacity, std::memory_order_release);
+	return true;
+}
+
+String PyTschirpMidiLog::format(Record const &record) const
+{
+	// Formatting happens only here, on the drainer thread
+	String line = String(record.timestamp / 1000.0, 3) + (record.isOut ? " O: " : " I: ");
+	int available = std::min(record.length, kMaxBytes);
+	if (record.data[0] == 0xf0) {
+		if (level_ == SUMMARY) {
+			line += "Sysex, " + String(record.length) + " bytes";
+		}
+		else {
+			line += "Sysex " + String::toHexString(record.data, available);
+			if (available < record.length) {
+				line += " ... (" + String(record.length) + " bytes)";
+			}
+		}
+	}
+	else {
+		line += MidiMessage(record.data, available).getDescription();
+	}
+
+	return line;
+}
+
+void PyTschirpMidiLog::write(String const &lines)
+{
+	std::lock_guard<std::mutex> callGuard(outputCallLock_);
+	std::function<void(std::string const &)> output;
+	{
+		std::lock_guard<std::mutex> guard(outputLock_);
+		if (file_.is_open()) {
+			file_ << lines;
+			return;
+		}
+		output = output_;
+	}
+	// Without outputLock_, the output function might wait for the GIL held by a thread that waits for the lock in setLogFile()
+	if (output) {
+		output(lines.toStdString());
+	}
+	else {
+		std::cout << lines;
+	}
+}
@@ -0,0 +1,74 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// MIDI logger that can be called from the MIDI threads without locking and without the GIL. log() only copies the raw bytes and
+// a timestamp into a bounded lock-free ring buffer, a background thread formats the records and writes them to a file or the output function,
+// which is std::cout if none is set.
+class PyTschirpMidiLog {
+public:
+	enum Level {
+		OFF = 0,
+		SUMMARY = 1, // Message type and length only, no sysex contents
+		FULL = 2
+	};
+
+	static PyTschirpMidiLog &instance();
+	~PyTschirpMidiLog();
+
+	void log(MidiMessage const &message, bool isOut);
+
+	void setLevel(int level);
+	int level() const;
+	void setLogFile(std::string const &filename); // Empty string logs to the output function again
+	// Called from the background thread with a block of lines. Waits until a call of the previous output function has returned,
+	// so if that one needs the GIL, call this without holding it. nullptr for std::cout
+	void setOutput(std::function<void(std::string const &)> output);
+	void flush(); // Waits until everything logged so far has been written
+	uint64 droppedRecords() const;
+
+private:
+	static const int kMaxBytes = 64; // Longer messages are truncated, the original length is kept
+	static const size_t kCapacity = 4096; // Must be a power of two
+
+	struct Record {
+		std::atomic<size_t> sequence;
+		double timestamp;
+		bool isOut;
+		int length;
+		uint8 data[kMaxBytes];
+	};
+
+	PyTschirpMidiLog();
+
+	void drain();
+	bool pop(Record &recordOut);
+	String format(Record const &record) const;
+	void write(String const &lines);
+
+	Record *records_;
+	std::atomic<size_t> enqueuePos_;
+	std::atomic<size_t> dequeuePos_;
+	std::atomic<int> level_;
+	std::atomic<uint64> dropped_;
+	std::atomic<uint64> written_;
+	std::atomic<uint64> accepted_;
+	std::atomic<bool> shutdown_;
+	std::mutex outputLock_;
+	std::ofstream file_;
+	std::function<void(std::string const &)> output_; // Called holding outputCallLock_ only
+	std::mutex outputCallLock_;
+	std::thread drainer_;
+};
@@ -0,0 +1,184 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "PyTschirpMidiSender.h"
+
+#include "PyTschirpStats.h"
+
+#include <algorithm>
+#include <chrono>
+
+std::shared_ptr<PyTschirpMidiSender> PyTschirpMidiSender::forSynth(std::shared_ptr<midikraft::Synth> synth)
+{
+	static std::mutex lock;
+	static std::map<midikraft::Synth *, std::pair<std::weak_ptr<midikraft::Synth>, std::shared_ptr<PyTschirpMidiSender>>> senders;
+
+	std::lock_guard<std::mutex> guard(lock);
+	// Drop the senders of synths that are gone, the address might have been reused
+	for (auto it = senders.begin(); it != senders.end(); ) {
+		if (it->second.first.expired())
+			it = senders.erase(it);
+		else
+			++it;
+	}
+	auto found = senders.find(synth.get());
+	if (found != senders.end()) {
+		return found->second.second;
+	}
+	std::shared_ptr<PyTschirpMidiSender> sender(new PyTschirpMidiSender(synth));
+	senders[synth.get()] = std::make_pair(std::weak_ptr<midikraft::Synth>(synth), sender);
+	return sender;
+}
+
+PyTschirpMidiSender::PyTschirpMidiSender(std::weak_ptr<midikraft::Synth> synth) : synth_(synth), bytesPerSecond_(kDinBytesPerSecond)
+{
+	thread_ = std::thread(&PyTschirpMidiSender::run, this);
+}
+
+PyTschirpMidiSender::~PyTschirpMidiSender()
+{
+	// The thread sends what is still waiting before it stops
+	{
+		std::lock_guard<std::mutex> guard(lock_);
+		shutdown_ = true;
+	}
+	wakeUp_.notify_all();
+	thread_.join();
+}
+
+void PyTschirpMidiSender::enqueue(juce::MidiDeviceInfo const &output, std::vector<Update> const &updates)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock_);
+		uint64 newBlock = firstBlock_ + blocks_.size();
+		Block block{ output, {} };
+		for (auto const &update : updates) {
+			auto found = blockOfKey_.find(update.key);
+			if (found != blockOfKey_.end()) {
+				// Last value wins. The older value gives up its place, so the newer one can't overtake anything enqueued in between
+				auto &older = found->second == newBlock ? block.updates : blocks_[(size_t)(found->second - firstBlock_)].updates;
+				older.erase(std::find_if(older.begin(), older.end(), [&update](Update const &u) { return u.key == update.key; }));
+				pendingUpdates_--;
+				droppedUpdates_++;
+			}
+			blockOfKey_[update.key] = newBlock;
+			block.updates.push_back(update);
+			pendingUpdates_++;
+		}
+		if (!block.updates.empty()) {
+			blocks_.push_back(std::move(block));
+		}
+	}
+	wakeUp_.notify_one();
+}
+
+void PyTschirpMidiSender::flush()
+{
+	std::unique_lock<std::mutex> guard(lock_);
+	allSent_.wait(guard, [this]() { return pendingUpdates_ == 0 && !sending_; });
+}
+
+void PyTschirpMidiSender::setBytesPerSecond(int bytesPerSecond)
+{
+	bytesPerSecond_ = std::max(0, bytesPerSecond);
+	wakeUp_.notify_one();
+}
+
+int PyTschirpMidiSender::bytesPerSecond() const
+{
+	return bytesPerSecond_;
+}
+
+PyTschirpMidiSender::Stats PyTschirpMidiSender::stats()
+{
+	std::lock_guard<std::mutex> guard(lock_);
+	return { pendingUpdates_, droppedUpdates_, messagesSent_, bytesSent_ };
+}
+
+void PyTschirpMidiSender::resetStats()
+{
+	std::lock_guard<std::mutex> guard(lock_);
+	droppedUpdates_ = 0;
+	messagesSent_ = 0;
+	bytesSent_ = 0;
+}
+
+void PyTschirpMidiSender::run()
+{
+	auto budgetTime = std::chrono::steady_clock::now();
+	juce::MidiDeviceInfo output;
+	std::vector<MidiMessage> messages;
+	while (takeNext(output, messages)) {
+		size_t bytes = 0;
+		for (auto const &message : messages) {
+			bytes += (size_t)message.getRawDataSize();
+		}
+
+		// Without the synth there is nobody to send to anymore, the messages are dropped and not counted
+		auto synth = synth_.lock();
+		if (synth) {
+			synth->sendBlockOfMessagesToSynth(output, messages);
+			PyTschirpStats::countSent(synth->getName(), messages.size(), bytes);
+		}
+
+		int rate = bytesPerSecond_;
+		{
+			std::lock_guard<std::mutex> guard(lock_);
+			if (synth) {
+				messagesSent_ += messages.size();
+				bytesSent_ += bytes;
+			}
+			sending_ = false;
+		}
+		allSent_.notify_all();
+
+		if (rate > 0) {
+			// Don't send the next block before the link had the time to transmit this one
+			budgetTime = std::max(budgetTime, std::chrono::steady_clock::now()) + std::chrono::microseconds(bytes * 1000000 / rate);
+			std::this_thread::sleep_until(budgetTime);
+		}
+	}
+}
+
+bool PyTschirpMidiSender::takeNext(juce::MidiDeviceInfo &outputOut, std::vector<MidiMessage> &messagesOut)
+{
+	std::unique_lock<std::mutex> guard(lock_);
+	wakeUp_.wait(guard, [this]() { return shutdown_ || pendingUpdates_ > 0; });
+
+	auto popFront = [this]() {
+		for (auto const &update : blocks_.front().updates) {
+			blockOfKey_.erase(update.key);
+		}
+		pendingUpdates_ -= (int)blocks_.front().updates.size();
+		blocks_.pop_front();
+		firstBlock_++;
+	};
+	// Blocks whose values have all been replaced by newer ones
+	while (!blocks_.empty() && blocks_.front().updates.empty()) {
+		popFront();
+	}
+	if (blocks_.empty()) {
+		// Only after everything enqueued has been sent, live edits must not get lost when the sender goes away
+		return false;
+	}
+
+	messagesOut.clear();
+	outputOut = blocks_.front().output;
+	// Unpaced, everything waiting for the same output goes out as one block. Paced, one block at a time, so newer values can still replace the rest
+	bool takeAll = bytesPerSecond_ == 0;
+	do {
+		auto const &block = blocks_.front();
+		if (!block.updates.empty() && block.output.identifier != outputOut.identifier) {
+			break;
+		}
+		for (auto const &update : block.updates) {
+			std::copy(update.messages.cbegin(), update.messages.cend(), std::back_inserter(messagesOut));
+		}
+		popFront();
+	} while (takeAll && !blocks_.empty());
+	sending_ = true;
+	return true;
+}
@@ -0,0 +1,75 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "Synth.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+
+// Sends the live edit messages of a synth on a background thread. The updates of one enqueue() call stay together and are sent as one
+// block, in the order of the calls. A key (the parameter) is pending only once, so a newer value removes the messages of an older value
+// that hasn't been sent yet, and is sent with the newer block. The output is paced to a bytes per second budget so a fast loop in Python
+// can't run ahead of a slow MIDI link. Everything enqueued is sent before the sender is destroyed.
+class PyTschirpMidiSender {
+public:
+	static const int kDinBytesPerSecond = 3125; // 31.25 kBaud, 10 bits per byte
+
+	static std::shared_ptr<PyTschirpMidiSender> forSynth(std::shared_ptr<midikraft::Synth> synth);
+
+	~PyTschirpMidiSender();
+
+	struct Update {
+		void const *key;
+		std::vector<MidiMessage> messages;
+	};
+	void enqueue(juce::MidiDeviceInfo const &output, std::vector<Update> const &updates);
+	void flush(); // Blocks until everything enqueued has been sent
+
+	void setBytesPerSecond(int bytesPerSecond); // 0 means unlimited
+	int bytesPerSecond() const;
+
+	struct Stats {
+		int queueDepth;
+		uint64 droppedUpdates;
+		uint64 messagesSent;
+		uint64 bytesSent;
+	};
+	Stats stats();
+	void resetStats();
+
+private:
+	struct Block {
+		juce::MidiDeviceInfo output;
+		std::vector<Update> updates;
+	};
+
+	PyTschirpMidiSender(std::weak_ptr<midikraft::Synth> synth);
+
+	void run();
+	bool takeNext(juce::MidiDeviceInfo &outputOut, std::vector<MidiMessage> &messagesOut);
+
+	std::weak_ptr<midikraft::Synth> synth_;
+	std::atomic<int> bytesPerSecond_;
+	std::mutex lock_;
+	std::condition_variable wakeUp_;
+	std::condition_variable allSent_;
+	std::deque<Block> blocks_;
+	uint64 firstBlock_ = 0; // Sequence number of blocks_.front()
+	std::map<void const *, uint64> blockOfKey_; // Sequence number of the block the key is pending in
+	int pendingUpdates_ = 0;
+	bool sending_ = false;
+	bool shutdown_ = false;
+	uint64 droppedUpdates_ = 0;
+	uint64 messagesSent_ = 0;
+	uint64 bytesSent_ = 0;
+	std::thread thread_;
+};
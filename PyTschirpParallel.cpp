@@ -0,0 +1,106 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "PyTschirpParallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+int defaultThreadCount()
+{
+	return std::max(1, (int)std::thread::hardware_concurrency());
+}
+
+void parallelForEach(int count, int threads, std::function<void(int)> work, std::function<void(int)> done)
+{
+	if (count <= 0) {
+		return;
+	}
+	if (threads <= 0) {
+		threads = defaultThreadCount();
+	}
+	threads = std::min(threads, count);
+
+	std::atomic<int> next(0);
+	std::atomic<bool> abort(false);
+	std::mutex lock;
+	std::condition_variable itemCompleted;
+	std::deque<int> completed;
+	std::exception_ptr firstError;
+
+	auto worker = [&]() {
+		while (!abort) {
+			int index = next++;
+			if (index >= count) {
+				break;
+			}
+			bool failed = false;
+			try {
+				work(index);
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> guard(lock);
+				if (!firstError) {
+					firstError = std::current_exception();
+				}
+				abort = true;
+				failed = true;
+			}
+			std::lock_guard<std::mutex> guard(lock);
+			// A failed item must never be handed to done(), its results are incomplete
+			if (!failed) {
+				completed.push_back(index);
+			}
+			itemCompleted.notify_one();
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (int i = 0; i < threads; i++) {
+		pool.emplace_back(worker);
+	}
+
+	// Hand out the results on the calling thread in the order of completion
+	int handedOut = 0;
+	while (handedOut < count && !abort) {
+		int index;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			itemCompleted.wait(guard, [&]() { return !completed.empty() || abort; });
+			if (abort || completed.empty()) {
+				break;
+			}
+			index = completed.front();
+			completed.pop_front();
+		}
+		handedOut++;
+		if (done) {
+			try {
+				done(index);
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> guard(lock);
+				if (!firstError) {
+					firstError = std::current_exception();
+				}
+				abort = true;
+			}
+		}
+	}
+
+	for (auto &thread : pool) {
+		thread.join();
+	}
+	if (firstError) {
+		std::rethrow_exception(firstError);
+	}
+}
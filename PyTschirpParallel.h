@@ -0,0 +1,17 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include <functional>
+
+// Number of worker threads to use when the caller specifies 0
+int defaultThreadCount();
+
+// Runs work(index) for all indexes from 0 to count - 1 on a pool of worker threads. If given, done(index) is called on the calling thread
+// as soon as an item has completed, so results can be handed out while the remaining items are still being processed.
+// The first exception thrown by either function is rethrown on the calling thread after all workers have stopped, and no done() is called after it.
+void parallelForEach(int count, int threads, std::function<void(int)> work, std::function<void(int)> done = nullptr);
@@ -0,0 +1,235 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "PyTschirpParameterIndex.h"
+
+#include "Capability.h"
+
+#include "DetailedParametersCapability.h"
+#include "LayeredPatchCapability.h"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <typeindex>
+
+std::shared_ptr<PyTschirpParameterIndex> PyTschirpParameterIndex::forPatch(std::shared_ptr<midikraft::Patch> patch)
+{
+	static std::mutex lock;
+	static std::map<std::type_index, std::shared_ptr<PyTschirpParameterIndex>> indexPerPatchType;
+	static std::shared_ptr<PyTschirpParameterIndex> emptyIndex(new PyTschirpParameterIndex({ {} }, 0));
+
+	if (!patch) {
+		return emptyIndex;
+	}
+
+	std::type_index patchType(typeid(*patch));
+	std::lock_guard<std::mutex> guard(lock);
+	auto found = indexPerPatchType.find(patchType);
+	if (found != indexPerPatchType.end()) {
+		return found->second;
+	}
+
+	// First patch of this type we see, build the table once
+	std::shared_ptr<PyTschirpParameterIndex> index = emptyIndex;
+	auto params = midikraft::Capability::hasCapability<midikraft::DetailedParametersCapability>(patch);
+	if (params) {
+		auto layeredPatch = midikraft::Capability::hasCapability<midikraft::LayeredPatchCapability>(patch);
+		int numberOfLayers = layeredPatch ? layeredPatch->numberOfLayers() : 0;
+		// Ask once per layer, synths creating new definitions for every call give us a set we can point at the layer for good
+		std::vector<std::vector<std::shared_ptr<midikraft::SynthParameterDefinition>>> layerDefinitions({ params->allParameterDefinitions() });
+		for (int layerNo = 1; layerNo < numberOfLayers; layerNo++) {
+			layerDefinitions.push_back(params->allParameterDefinitions());
+		}
+		index.reset(new PyTschirpParameterIndex(layerDefinitions, numberOfLayers));
+	}
+	indexPerPatchType[patchType] = index;
+	return index;
+}
+
+PyTschirpParameterIndex::PyTschirpParameterIndex(std::vector<std::vector<std::shared_ptr<midikraft::SynthParameterDefinition>>> const &layerDefinitions, int numberOfLayers) :
+	definitions_(layerDefinitions[0]), numberOfLayers_(numberOfLayers)
+{
+	// A parameter gets its own definition per layer if the synth handed out a different object for every layer
+	std::vector<bool> separateLayers(definitions_.size(), true);
+	for (size_t layerNo = 1; layerNo < layerDefinitions.size(); layerNo++) {
+		auto const &layer = layerDefinitions[layerNo];
+		for (size_t i = 0; i < definitions_.size(); i++) {
+			bool separate = layer.size() == definitions_.size() && layer[i]->name() == definitions_[i]->name();
+			for (size_t other = 0; separate && other < layerNo; other++) {
+				separate = layer[i] != layerDefinitions[other][i];
+			}
+			separateLayers[i] = separateLayers[i] && separate;
+		}
+	}
+
+	for (int i = 0; i < (int) definitions_.size(); i++) {
+		auto name = definitions_[i]->name();
+		names_.push_back(name);
+		byName_.emplace(name, i);
+		capabilities_.push_back(capabilitiesOf(definitions_[i], separateLayers[i] ? 0 : -1));
+	}
+	// Reserved, as the handles point into it
+	layerCapabilities_.reserve(definitions_.size() * (size_t)std::max(numberOfLayers_ - 1, 0));
+
+	// capabilities_ is complete now and won't be resized again, so the handles can point into it
+	for (int i = 0; i < (int) capabilities_.size(); i++) {
+		auto const &caps = capabilities_[i];
+		for (int layerNo = -1; layerNo < numberOfLayers_; layerNo++) {
+			if (layerNo > 0 && caps.multiLayer && caps.layer != -1) {
+				layerCapabilities_.push_back(capabilitiesOf(layerDefinitions[layerNo][i], layerNo));
+				handles_.push_back(Handle(&layerCapabilities_.back(), i, layerNo));
+			}
+			else {
+				handles_.push_back(Handle(&caps, i, layerNo));
+			}
+		}
+	}
+	for (int i = 0; i < (int) capabilities_.size(); i++) {
+		if (capabilities_[i].multiLayer && numberOfLayers_ > 0) {
+			for (int layerNo = 0; layerNo < numberOfLayers_; layerNo++) {
+				patchHandles_.push_back(&handle(i, layerNo));
+			}
+		}
+		else {
+			patchHandles_.push_back(&handle(i, -1));
+		}
+	}
+	// Second pass for the Python friendly alias, e.g. patch.Seq_Track_1 instead of patch['Seq Track 1']. A real name always wins.
+	for (int i = 0; i < (int) definitions_.size(); i++) {
+		auto alias = names_[i];
+		std::replace(alias.begin(), alias.end(), ' ', '_');
+		byName_.emplace(alias, i);
+	}
+}
+
+PyTschirpParameterIndex::Capabilities PyTschirpParameterIndex::capabilitiesOf(std::shared_ptr<midikraft::SynthParameterDefinition> def, int layer)
+{
+	Capabilities caps{ def,
+		(def->type() == midikraft::SynthParameterDefinition::ParamType::INT_ARRAY) || (def->type() == midikraft::SynthParameterDefinition::ParamType::LOOKUP_ARRAY),
+		midikraft::Capability::hasCapability<midikraft::SynthIntParameterCapability>(def),
+		midikraft::Capability::hasCapability<midikraft::SynthVectorParameterCapability>(def),
+		midikraft::Capability::hasCapability<midikraft::SynthParameterLiveEditCapability>(def),
+		midikraft::Capability::hasCapability<midikraft::SynthMultiLayerParameterCapability>(def),
+		-1 };
+	if (caps.multiLayer && layer != -1) {
+		// Done once here, the definition is not shared with any other layer
+		caps.multiLayer->setSourceLayer(layer);
+		caps.multiLayer->setTargetLayer(layer);
+		caps.layer = layer;
+	}
+	return caps;
+}
+
+std::shared_ptr<midikraft::SynthParameterDefinition> PyTschirpParameterIndex::find(std::string const &name) const
+{
+	int index = indexOf(name);
+	return index != -1 ? definitions_[index] : nullptr;
+}
+
+int PyTschirpParameterIndex::indexOf(std::string const &name) const
+{
+	auto found = byName_.find(name);
+	return found != byName_.end() ? found->second : -1;
+}
+
+PyTschirpParameterIndex::Capabilities const & PyTschirpParameterIndex::capabilities(int index) const
+{
+	return capabilities_[index];
+}
+
+int PyTschirpParameterIndex::numberOfLayers() const
+{
+	return numberOfLayers_;
+}
+
+PyTschirpParameterIndex::Handle const & PyTschirpParameterIndex::handle(int index, int layerNo) const
+{
+	if (layerNo < -1 || layerNo >= numberOfLayers_) {
+		throw std::runtime_error("PyTschirp: Invalid layer number for parameter access");
+	}
+	return handles_[index * (numberOfLayers_ + 1) + layerNo + 1];
+}
+
+std::vector<PyTschirpParameterIndex::Handle const *> const & PyTschirpParameterIndex::patchHandles() const
+{
+	return patchHandles_;
+}
+
+std::vector<std::shared_ptr<midikraft::SynthParameterDefinition>> const & PyTschirpParameterIndex::definitions() const
+{
+	return definitions_;
+}
+
+std::vector<std::string> const & PyTschirpParameterIndex::parameterNames() const
+{
+	return names_;
+}
+
+PyTschirpParameterIndex::Handle::Handle(Capabilities const *caps, int index, int layerNo) : caps_(caps), index_(index), layerNo_(layerNo)
+{
+}
+
+PyTschirpParameterIndex::Capabilities const & PyTschirpParameterIndex::Handle::capabilities() const
+{
+	return *caps_;
+}
+
+int PyTschirpParameterIndex::Handle::index() const
+{
+	return index_;
+}
+
+int PyTschirpParameterIndex::Handle::layerNo() const
+{
+	return layerNo_;
+}
+
+void PyTschirpParameterIndex::Handle::selectLayer() const
+{
+	// Only for definitions shared by all layers, the others address their layer already
+	if (caps_->multiLayer && caps_->layer == -1) {
+		int layer = std::max(layerNo_, 0);
+		caps_->multiLayer->setSourceLayer(layer);
+		caps_->multiLayer->setTargetLayer(layer);
+	}
+}
+
+bool PyTschirpParameterIndex::Handle::valueInPatch(midikraft::Patch const &patch, int &outValue) const
+{
+	selectLayer();
+	return caps_->intParam->valueInPatch(patch, outValue);
+}
+
+bool PyTschirpParameterIndex::Handle::valueInPatch(midikraft::Patch const &patch, std::vector<int> &outValue) const
+{
+	selectLayer();
+	return caps_->vectorParam->valueInPatch(patch, outValue);
+}
+
+void PyTschirpParameterIndex::Handle::setInPatch(midikraft::Patch &patch, int value) const
+{
+	selectLayer();
+	caps_->intParam->setInPatch(patch, value);
+}
+
+void PyTschirpParameterIndex::Handle::setInPatch(midikraft::Patch &patch, std::vector<int> const &value) const
+{
+	selectLayer();
+	caps_->vectorParam->setInPatch(patch, value);
+}
+
+std::vector<MidiMessage> PyTschirpParameterIndex::Handle::setValueMessages(std::shared_ptr<midikraft::Patch> const &patch, midikraft::Synth const *synth) const
+{
+	selectLayer();
+	return caps_->liveEdit->setValueMessages(patch, synth);
+}
+
+std::string PyTschirpParameterIndex::Handle::valueInPatchToText(midikraft::Patch const &patch) const
+{
+	selectLayer();
+	return caps_->def->valueInPatchToText(patch);
+}
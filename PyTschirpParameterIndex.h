@@ -0,0 +1,89 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "Patch.h"
+#include "SynthParameterDefinition.h"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Name to parameter definition lookup table, built once per patch type and shared by all patches of that type.
+// The capabilities of each definition are resolved here once as well, so the hot paths don't need a dynamic cast per call
+class PyTschirpParameterIndex {
+public:
+	static std::shared_ptr<PyTschirpParameterIndex> forPatch(std::shared_ptr<midikraft::Patch> patch);
+
+	struct Capabilities {
+		std::shared_ptr<midikraft::SynthParameterDefinition> def;
+		bool isVector; // INT_ARRAY or LOOKUP_ARRAY, use vectorParam instead of intParam
+		std::shared_ptr<midikraft::SynthIntParameterCapability> intParam; // nullptr if not implemented, same for the others
+		std::shared_ptr<midikraft::SynthVectorParameterCapability> vectorParam;
+		std::shared_ptr<midikraft::SynthParameterLiveEditCapability> liveEdit;
+		std::shared_ptr<midikraft::SynthMultiLayerParameterCapability> multiLayer;
+		int layer; // The layer a multi layer definition addresses for good, -1 if the definition is shared by all layers
+	};
+
+	// One parameter in one layer, or in the whole patch for layer -1, which goes to the first layer. The handles are created with the index
+	// for every layer and never change. The midikraft definitions of layered synths store the layer they address, so the index asks the
+	// synth for one set of definitions per layer and points each at its layer once, and the handles can be used from many threads.
+	// A synth that returns the same definitions for every call leaves them shared by all layers, the handle of a multi layer parameter
+	// then points the definition at its layer for every access, and must not be used from several threads at once.
+	// The capability used must be implemented, check capabilities() first
+	class Handle {
+	public:
+		Capabilities const &capabilities() const;
+		int index() const; // Of the parameter, the same for all layers
+		int layerNo() const;
+
+		bool valueInPatch(midikraft::Patch const &patch, int &outValue) const;
+		bool valueInPatch(midikraft::Patch const &patch, std::vector<int> &outValue) const;
+		void setInPatch(midikraft::Patch &patch, int value) const;
+		void setInPatch(midikraft::Patch &patch, std::vector<int> const &value) const;
+		std::vector<MidiMessage> setValueMessages(std::shared_ptr<midikraft::Patch> const &patch, midikraft::Synth const *synth) const;
+		std::string valueInPatchToText(midikraft::Patch const &patch) const;
+
+	private:
+		friend class PyTschirpParameterIndex;
+		Handle(Capabilities const *caps, int index, int layerNo);
+		void selectLayer() const;
+
+		Capabilities const *caps_;
+		int index_;
+		int layerNo_;
+	};
+
+	// Accepts the parameter name as defined by the synth, or the same name with spaces replaced by underscores
+	std::shared_ptr<midikraft::SynthParameterDefinition> find(std::string const &name) const;
+	int indexOf(std::string const &name) const; // -1 if not found
+
+	Capabilities const &capabilities(int index) const;
+
+	int numberOfLayers() const; // 0 for patches without LayeredPatchCapability
+	Handle const &handle(int index, int layerNo) const;
+	// Every value of a patch exactly once, i.e. the multi layer parameters once per layer, and all others for the whole patch
+	std::vector<Handle const *> const &patchHandles() const;
+
+	std::vector<std::shared_ptr<midikraft::SynthParameterDefinition>> const &definitions() const;
+	std::vector<std::string> const &parameterNames() const;
+
+private:
+	// One set of definitions per layer, or just one for patches without layers
+	PyTschirpParameterIndex(std::vector<std::vector<std::shared_ptr<midikraft::SynthParameterDefinition>>> const &layerDefinitions, int numberOfLayers);
+	static Capabilities capabilitiesOf(std::shared_ptr<midikraft::SynthParameterDefinition> def, int layer);
+
+	std::vector<std::shared_ptr<midikraft::SynthParameterDefinition>> definitions_; // Those of the first layer
+	std::vector<std::string> names_;
+	std::unordered_map<std::string, int> byName_;
+	std::vector<Capabilities> capabilities_;
+	std::vector<Capabilities> layerCapabilities_; // Of the definitions of the other layers, where the synth gave us separate ones
+	int numberOfLayers_;
+	std::vector<Handle> handles_; // numberOfLayers_ + 1 per parameter, the first one for the whole patch
+	std::vector<Handle const *> patchHandles_;
+};
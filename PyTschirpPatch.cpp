@@ -6,24 +6,55 @@
 
 #include "PyTschirpPatch.h"
 
+#include "PyTschirpParameterIndex.h"
+#include "PyTschirpMidiSender.h"
+#include "PyTschirpStats.h"
+#include "PyTschirpFingerprint.h"
+#include "PyTschirpHelpers.h"
+
 #include "Capability.h"
 
 #include "LayeredPatchCapability.h"
-#include "DetailedParametersCapability.h"
 #include "StoredPatchNameCapability.h"
+#include "EditBufferCapability.h"
+
+#ifdef _MSC_VER
+#pragma warning ( push )
+#pragma warning ( disable: 4100 )
+#endif
+#include <pybind11/stl.h>
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
 
 #include <algorithm>
 
 namespace py = pybind11;
 
-PyTschirp::PyTschirp(std::shared_ptr<midikraft::Patch> p, std::weak_ptr<midikraft::Synth> synth, int layerNo) : PyTschirp(p, synth)
+static bool sameValue(PyTschirpParameterIndex::Handle const &param, midikraft::Patch const &a, midikraft::Patch const &b)
 {
-	layerNo_ = layerNo;
+	auto const &caps = param.capabilities();
+	if (caps.isVector) {
+		std::vector<int> valueA, valueB;
+		return caps.vectorParam && param.valueInPatch(a, valueA) && param.valueInPatch(b, valueB) && valueA == valueB;
+	}
+	int valueA, valueB;
+	return caps.intParam && param.valueInPatch(a, valueA) && param.valueInPatch(b, valueB) && valueA == valueB;
+}
 
-	auto layeredPatch = midikraft::Capability::hasCapability<midikraft::LayeredPatchCapability>(patch_);
-	if (layeredPatch) {
-		if (!(layerNo >= 0 && layerNo < layeredPatch->numberOfLayers())) {
-			throw std::runtime_error("PyTschirp: Invalid layer number given to layerName()");
+static void copyValue(PyTschirpParameterIndex::Handle const &param, midikraft::Patch const &from, midikraft::Patch &to)
+{
+	auto const &caps = param.capabilities();
+	if (caps.isVector) {
+		std::vector<int> value;
+		if (caps.vectorParam && param.valueInPatch(from, value)) {
+			param.setInPatch(to, value);
+		}
+	}
+	else {
+		int value;
+		if (caps.intParam && param.valueInPatch(from, value)) {
+			param.setInPatch(to, value);
 		}
 	}
 }
@@ -35,64 +66,163 @@ PyTschirp::PyTschirp(std::shared_ptr<midikraft::DataFile> p, std::weak_ptr<midik
 	if (!correctPatch) {
 		throw std::runtime_error("PyTschirp: Program error: Can't downcast, wrong patch type!");
 	}
-	patch_ = correctPatch;
+	slot_ = std::make_shared<PyTschirpPatchSlot>(correctPatch, synth);
 	synth_ = synth;
+	index_ = PyTschirpParameterIndex::forPatch(correctPatch);
+	auto lockedSynth = synth.lock();
+	if (lockedSynth) {
+		synthCapabilities_ = PyTschirpSynthCapabilities::forSynth(lockedSynth);
+	}
 }
 
 PyTschirp::PyTschirp(std::shared_ptr<midikraft::Patch> patch)
 {
-	patch_ = patch;
+	slot_ = std::make_shared<PyTschirpPatchSlot>(patch, std::weak_ptr<midikraft::Synth>());
+	index_ = PyTschirpParameterIndex::forPatch(patch);
 }
 
 PyTschirpAttribute PyTschirp::get_attr(std::string const &attrName)
 {
-	if (layerNo_ == -1) {
-		return PyTschirpAttribute(patch_, attrName);
-	}
-	else {
-		return PyTschirpAttribute(patch_, attrName, layerNo_);
-	}
+	return attribute(attrName);
 }
 
 void PyTschirp::set_attr(std::string const &name, std::vector<int> const &value)
 {
-	auto attr = PyTschirpAttribute(patch_, name);
+	auto attr = attribute(name);
 	attr.set(value);
+	sendLiveEdit(attr.handle());
+}
+
+void PyTschirp::set_attr(std::string const &name, int value)
+{
+	auto attr = attribute(name);
+	attr.set(value);
+	sendLiveEdit(attr.handle());
+}
+
+py::dict PyTschirp::sync()
+{
+	auto synth = synth_.lock();
+	auto location = this->location();
+	if (!synth || !location || !location->channel.isValid()) {
+		throw std::runtime_error("PyTschirp: Synth hasn't been detected yet - run detect() first and check if it worked");
+	}
+
+	// Cost of the parameter by parameter update. If no device state is known, or a changed parameter can't be sent on its own, this is not an option.
+	// The device state is the synth's, whichever patch has been sent last, and it is only usable if it is of the same type as this patch
+	auto patch = slot_->patch();
+	std::vector<PyTschirpMidiSender::Update> updates;
+	size_t changed = 0;
+	size_t liveEditBytes = 0;
+	bool liveEditPossible = false;
+	synthCapabilities_->accessDeviceState([&](std::shared_ptr<midikraft::Patch> &deviceState) {
+		if (!deviceState || PyTschirpParameterIndex::forPatch(deviceState) != index_) {
+			return;
+		}
+		liveEditPossible = true;
+		if (deviceState->data() != patch->data()) {
+			for (auto param : index_->patchHandles()) {
+				if (!sameValue(*param, *deviceState, *patch)) {
+					changed++;
+					if (!param->capabilities().liveEdit) {
+						liveEditPossible = false;
+						break;
+					}
+					updates.push_back({ param, param->setValueMessages(patch, synth.get()) });
+					liveEditBytes += byteCount(updates.back().messages);
+				}
+			}
+			if (updates.empty()) {
+				// The data differs in something no parameter covers, only the complete dump brings the synth up to date
+				liveEditPossible = false;
+			}
+		}
+	});
+
+	// Cost of the edit buffer dump
+	std::vector<MidiMessage> editBufferDump;
+	auto editBufferCapability = synthCapabilities_->editBuffer();
+	if (editBufferCapability) {
+		editBufferDump = editBufferCapability->patchToSysex(patch);
+	}
+	size_t editBufferBytes = byteCount(editBufferDump);
 
-	if (isChannelValid()) {
-		auto liveEditing = midikraft::Capability::hasCapability<midikraft::SynthParameterLiveEditCapability>(attr.def());
-		if (liveEditing) {
-			// The synth is hot... we don't know if this patch is currently selected, but let's send the nrpn or other value changing message anyway!
-			auto messages = liveEditing->setValueMessages(patch_, synth_.lock().get());
-			synth_.lock()->sendBlockOfMessagesToSynth(midiOutput(), messages);
+	py::dict result;
+	result["changed"] = changed;
+	if (liveEditPossible && (updates.empty() || editBufferDump.empty() || liveEditBytes <= editBufferBytes)) {
+		result["method"] = updates.empty() ? "none" : "parameters";
+		result["bytes"] = liveEditBytes;
+		if (!updates.empty()) {
+			PyTschirpMidiSender::forSynth(synth)->enqueue(location->output, updates);
 		}
 	}
+	else if (!editBufferDump.empty()) {
+		result["method"] = "editBuffer";
+		result["bytes"] = editBufferBytes;
+		PyTschirpMidiSender::forSynth(synth)->enqueue(location->output, { { patch.get(), editBufferDump } });
+	}
+	else {
+		throw std::runtime_error("PyTschirp: Synth has no EditBufferCapability and the patch can't be sent parameter by parameter");
+	}
+	markAsSentToSynth();
+	return result;
 }
 
-void PyTschirp::set_attr(std::string const &name, int value)
+PyTschirpBatch PyTschirp::batch()
 {
-	auto attr = PyTschirpAttribute(patch_, name);
-	attr.set(value);
-	if (isChannelValid()) {
-		auto liveEditing = midikraft::Capability::hasCapability<midikraft::SynthParameterLiveEditCapability>(attr.def());
-		if (liveEditing) {
-			// The synth is hot... we don't know if this patch is currently selected, but let's send the nrpn or other value changing message anyway!
-			auto messages = liveEditing->setValueMessages(patch_, synth_.lock().get());
-			synth_.lock()->sendBlockOfMessagesToSynth(midiOutput(), messages);
+	return PyTschirpBatch(*this);
+}
+
+void PyTschirp::beginBatch()
+{
+	live_->batchDepth++;
+}
+
+void PyTschirp::commitBatch()
+{
+	if (live_->batchDepth == 0) {
+		throw std::runtime_error("PyTschirp: commitBatch() called without beginBatch()");
+	}
+	if (--live_->batchDepth == 0) {
+		auto modified = live_->modified;
+		live_->modified.clear();
+		live_->modifiedSet.clear();
+		sendLiveEdits(modified, false);
+	}
+}
+
+void PyTschirp::update(py::dict const &values)
+{
+	beginBatch();
+	try {
+		for (auto item : values) {
+			auto name = item.first.cast<std::string>();
+			if (py::isinstance<py::int_>(item.second)) {
+				set_attr(name, item.second.cast<int>());
+			}
+			else {
+				set_attr(name, item.second.cast<std::vector<int>>());
+			}
 		}
 	}
+	catch (...) {
+		// The patch has been modified up to here, so the synth should get these changes as well
+		commitBatch();
+		throw;
+	}
+	commitBatch();
 }
 
 std::string PyTschirp::getName()
 {
 	if (layerNo_ == -1) {
 		if (!synth_.expired())
-			return synth_.lock()->nameForPatch(patch_);
+			return synth_.lock()->nameForPatch(slot_->patch());
 		else
 			return "synth expired";
 	}
 	else {
-		auto layeredPatch = midikraft::Capability::hasCapability<midikraft::LayeredPatchCapability>(patch_);
+		auto layeredPatch = midikraft::Capability::hasCapability<midikraft::LayeredPatchCapability>(slot_->patch());
 		if (layeredPatch) {
 			return layeredPatch->layerName(layerNo_);
 		}
@@ -104,76 +234,208 @@ std::string PyTschirp::getName()
 
 void PyTschirp::setName(std::string const &newName)
 {
-	auto storedName = midikraft::Capability::hasCapability<midikraft::StoredPatchNameCapability>(patch_);
-	if (patch_) {
+	auto storedName = midikraft::Capability::hasCapability<midikraft::StoredPatchNameCapability>(slot_->writablePatch());
+	if (storedName) {
 		storedName->changeNameStoredInPatch(newName);
 	}
 }
 
 PyTschirp PyTschirp::layer(int layerNo)
 {
-	auto layeredPatch = midikraft::Capability::hasCapability<midikraft::LayeredPatchCapability>(patch_);
+	auto layeredPatch = midikraft::Capability::hasCapability<midikraft::LayeredPatchCapability>(slot_->patch());
 	if (!layeredPatch) {
 		throw std::runtime_error("PyTschirp: This is not a layered patch, can't retrieve layer");
 	}
+	if (!(layerNo >= 0 && layerNo < layeredPatch->numberOfLayers())) {
+		throw std::runtime_error("PyTschirp: Invalid layer number given to layer()");
+	}
 
-	// Create a new Tschirp that is the same as this one, but stores a layer number and thus will reroute all calls to the layer selected
-	return PyTschirp(patch_, synth_, layerNo);
+	// Create a new Tschirp that is the same as this one, but stores a layer number and thus will reroute all calls to the layer selected.
+	// Slot and live edit state are shared, so the layer view sees and sends all changes made through it
+	PyTschirp result(*this);
+	result.layerNo_ = layerNo;
+	return result;
+}
+
+PyTschirp PyTschirp::clone() const
+{
+	// The clone shares the patch data until one of the two is modified, and starts without an open batch
+	PyTschirp result(*this);
+	result.slot_ = slot_->clone();
+	result.live_ = std::make_shared<LiveEditState>();
+	return result;
 }
 
 std::vector<std::string> PyTschirp::parameterNames()
 {
-	std::vector<std::string> result;
-	auto params = midikraft::Capability::hasCapability<midikraft::DetailedParametersCapability>(patch_);
-	if (params) {
-		for (auto p : params->allParameterDefinitions()) {
-			result.push_back(p->name());
-		}
+	return index_->parameterNames();
+}
+
+std::string PyTschirp::fingerprint()
+{
+	auto synth = synth_.lock();
+	return PyTschirpFingerprint::forPatch(slot_->patch(), synth ? synth->getName() : std::string()).toString();
+}
+
+py::buffer_info PyTschirp::buffer()
+{
+	// The view is read only, so a clone keeps sharing its data. The slot keeps the patch alive as long as the Python object the view keeps alive,
+	// even when the clone gets its own copy later
+	auto const &data = slot_->pinnedPatch()->data();
+	return py::buffer_info(const_cast<uint8 *>(data.data()), sizeof(uint8), py::format_descriptor<uint8>::format(), 1, { (py::ssize_t) data.size() }, { (py::ssize_t) sizeof(uint8) }, true);
+}
+
+void PyTschirp::setData(py::buffer data)
+{
+	auto info = data.request();
+	if (info.ndim != 1 || info.itemsize != sizeof(uint8)) {
+		throw std::runtime_error("PyTschirp: setData() expects a one dimensional byte buffer");
+	}
+	auto patch = slot_->writablePatch();
+	if (info.size != (py::ssize_t) patch->data().size()) {
+		throw std::runtime_error("PyTschirp: setData() expects exactly as many bytes as the patch data has");
+	}
+	// Copy into the existing storage instead of replacing the vector, views returned by buffer() point into it
+	auto bytes = static_cast<uint8 const *>(info.ptr);
+	auto &storage = const_cast<midikraft::Synth::PatchData &>(patch->data());
+	if (bytes != storage.data()) {
+		std::copy(bytes, bytes + info.size, storage.begin());
 	}
-	return result;
 }
 
-std::shared_ptr<midikraft::Patch> PyTschirp::patchPtr()
+std::shared_ptr<midikraft::Patch> PyTschirp::patchPtr() const
 {
-	return patch_;
+	return slot_->patch();
 }
 
-std::string PyTschirp::underscoreToSpace(std::string const &input)
+std::shared_ptr<midikraft::Synth> PyTschirp::synthPtr() const
 {
-	auto copy = input;
-	std::replace(copy.begin(), copy.end(), '_', ' ');
-	return copy;
+	return synth_.lock();
 }
 
-juce::MidiDeviceInfo PyTschirp::midiInput()
+void PyTschirp::markAsSentToSynth()
 {
-	if (!synth_.expired()) {
-		auto location = midikraft::Capability::hasCapability<midikraft::MidiLocationCapability>(synth_.lock());
-		if (location) {
-			return location->midiInput();
+	if (synthCapabilities_) {
+		auto copy = clonePatch();
+		synthCapabilities_->accessDeviceState([&copy](std::shared_ptr<midikraft::Patch> &deviceState) {
+			deviceState = copy;
+		});
+	}
+}
+
+PyTschirpParameterIndex::Handle const *PyTschirp::attributeHandle(std::string const &name) const
+{
+	return attribute(name).handle();
+}
+
+void PyTschirp::updateHandles(std::vector<std::pair<PyTschirpParameterIndex::Handle const *, std::vector<int>>> const &values, bool sendNow)
+{
+	auto patch = slot_->writablePatch();
+	std::vector<PyTschirpParameterIndex::Handle const *> params;
+	for (auto const &value : values) {
+		if (value.first->capabilities().isVector) {
+			value.first->setInPatch(*patch, value.second);
+		}
+		else {
+			value.first->setInPatch(*patch, value.second.at(0));
 		}
+		params.push_back(value.first);
 	}
-	return juce::MidiDeviceInfo();
+	sendLiveEdits(params, sendNow);
 }
 
-juce::MidiDeviceInfo PyTschirp::midiOutput()
+std::shared_ptr<midikraft::Patch> PyTschirp::clonePatch() const
 {
-	if (!synth_.expired()) {
-		auto location = midikraft::Capability::hasCapability<midikraft::MidiLocationCapability>(synth_.lock());
-		if (location) {
-			return location->midiOutput();
+	return slot_->copyPatch();
+}
+
+PyTschirpAttribute PyTschirp::attribute(std::string const &name) const
+{
+	if (layerNo_ == -1) {
+		return PyTschirpAttribute(slot_, index_, name);
+	}
+	else {
+		return PyTschirpAttribute(slot_, index_, name, layerNo_);
+	}
+}
+
+void PyTschirp::sendLiveEdit(PyTschirpParameterIndex::Handle const *param)
+{
+	if (live_->batchDepth > 0) {
+		// Just remember the parameter, the value is taken from the patch when the batch is committed
+		if (param && live_->modifiedSet.insert(param).second) {
+			live_->modified.push_back(param);
 		}
 	}
-	return juce::MidiDeviceInfo();
+	else {
+		sendLiveEdits({ param }, false);
+	}
 }
 
-bool PyTschirp::isChannelValid() const
+void PyTschirp::sendLiveEdits(std::vector<PyTschirpParameterIndex::Handle const *> const &params, bool sendNow)
 {
-	if (!synth_.expired()) {
-		auto location = midikraft::Capability::hasCapability<midikraft::MidiLocationCapability>(synth_.lock());
-		if (location) {
-			return location->channel().isValid();
+	auto synth = synth_.lock();
+	if (!synth) {
+		return;
+	}
+	auto location = this->location();
+	if (!location || !location->channel.isValid()) {
+		return;
+	}
+
+	// The synth is hot... we don't know if this patch is currently selected, but let's send the nrpn or other value changing message anyway!
+	auto patch = slot_->patch();
+	std::vector<PyTschirpMidiSender::Update> updates;
+	std::vector<PyTschirpParameterIndex::Handle const *> sent;
+	for (auto param : params) {
+		if (param && param->capabilities().liveEdit) {
+			// The handle is the key, so the same parameter in different layers gets its own slot in the sender
+			updates.push_back({ param, param->setValueMessages(patch, synth.get()) });
+			sent.push_back(param);
+		}
+	}
+	if (!updates.empty()) {
+		// Whichever patch was sent last, the synth's edit buffer now has these values
+		synthCapabilities_->accessDeviceState([&](std::shared_ptr<midikraft::Patch> &deviceState) {
+			if (deviceState && PyTschirpParameterIndex::forPatch(deviceState) == index_) {
+				for (auto param : sent) {
+					copyValue(*param, *patch, *deviceState);
+				}
+			}
+		});
+		if (sendNow) {
+			std::vector<MidiMessage> messages;
+			for (auto const &update : updates) {
+				messages.insert(messages.end(), update.messages.cbegin(), update.messages.cend());
+			}
+			synth->sendBlockOfMessagesToSynth(location->output, messages);
+			PyTschirpStats::countSent(synth->getName(), messages.size(), byteCount(messages));
+		}
+		else {
+			// The sender thread paces the output, and replaces values of the same parameter still waiting to be sent
+			PyTschirpMidiSender::forSynth(synth)->enqueue(location->output, updates);
 		}
 	}
-	return false;
+}
+
+std::shared_ptr<PyTschirpSynthCapabilities::Location const> PyTschirp::location() const
+{
+	return synthCapabilities_ ? synthCapabilities_->location() : nullptr;
+}
+
+PyTschirpBatch::PyTschirpBatch(PyTschirp const &patch) : patch_(patch)
+{
+}
+
+PyTschirp PyTschirpBatch::enter()
+{
+	patch_.beginBatch();
+	return patch_;
+}
+
+void PyTschirpBatch::exit(py::object excType, py::object excValue, py::object traceback)
+{
+	ignoreUnused(excType, excValue, traceback);
+	// Also commit when the with block raised, the patch already contains the changes made so far
+	patch_.commitBatch();
 }
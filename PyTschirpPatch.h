@@ -21,6 +21,13 @@
 #endif
 
 #include "PyTschirpAttribute.h"
+#include "PyTschirpParameterIndex.h"
+#include "PyTschirpPatchSlot.h"
+#include "PyTschirpSynthCapabilities.h"
+
+#include <set>
+
+class PyTschirpBatch;
 
 class PyTschirp {	
 public:
@@ -32,30 +39,80 @@ public:
 	void set_attr(std::string const &name, int value);
 	void set_attr(std::string const &name, std::vector<int> const &value);
 
+	// Live edit transactions. While a batch is open, set_attr only modifies the patch, and commitBatch() sends 
+	// the messages for all modified parameters as one block, each parameter only once in the order of first modification
+	PyTschirpBatch batch();
+	void beginBatch();
+	void commitBatch();
+	void update(pybind11::dict const &values);
+
+	// Brings the synth in line with this patch by sending either the changed parameters or a complete edit buffer dump, whichever is fewer bytes.
+	// The comparison is made against what has been sent to the synth's edit buffer last by any patch, if that is known
+	pybind11::dict sync();
+
 	std::string getName();
 	void setName(std::string const &newName);
 
 	PyTschirp layer(int layerNo);
 
+	// Independent copy of this patch. The data is only copied when either the clone or the original is modified, so making many clones is cheap
+	PyTschirp clone() const;
+
 	std::string toText();
 
 	std::vector<std::string> parameterNames();
 
+	// Content hash of the parameter values, ignoring the name. Equal for duplicates of the same sound
+	std::string fingerprint();
+
+	// Raw patch data access without copying, this is what Python's memoryview() and numpy.frombuffer() see. The view is read only, use setData() to write.
+	// A view of a clone still sharing the data of its original follows the original, use bytes() for a snapshot
+	pybind11::buffer_info buffer();
+	void setData(pybind11::buffer data);
+
 	//! Use this at your own risk
-	std::shared_ptr<midikraft::Patch> patchPtr();
+	std::shared_ptr<midikraft::Patch> patchPtr() const;
+	std::shared_ptr<midikraft::Synth> synthPtr() const; // nullptr if the patch has no synth or it has expired
+
+	// Bindings not for python
+	void markAsSentToSynth(); // The synth's edit buffer is known to be identical to this patch
+	PyTschirpParameterIndex::Handle const *attributeHandle(std::string const &name) const; // Like get_attr, nullptr for an unknown name
+	// Writes the values through the handles and sends them as one block of live edits, int values are given as a vector of one element.
+	// With sendNow the block is sent on the calling thread right away, bypassing the pacing and coalescing of the synth's sender
+	void updateHandles(std::vector<std::pair<PyTschirpParameterIndex::Handle const *, std::vector<int>>> const &values, bool sendNow);
 
 private:
-	// Private constructor to create a layer accessing Tschirp
-	PyTschirp(std::shared_ptr<midikraft::Patch> p, std::weak_ptr<midikraft::Synth> synth, int layerNo);
+	// Live editing state, shared by all copies and layer views of this patch
+	struct LiveEditState {
+		int batchDepth = 0;
+		std::vector<PyTschirpParameterIndex::Handle const *> modified;
+		std::set<PyTschirpParameterIndex::Handle const *> modifiedSet;
+	};
 
-	std::string underscoreToSpace(std::string const &input);
+	PyTschirpAttribute attribute(std::string const &name) const;
+	void sendLiveEdit(PyTschirpParameterIndex::Handle const *param);
+	void sendLiveEdits(std::vector<PyTschirpParameterIndex::Handle const *> const &params, bool sendNow);
+	std::shared_ptr<midikraft::Patch> clonePatch() const;
 
-    juce::MidiDeviceInfo midiInput();
-    juce::MidiDeviceInfo midiOutput();
-	bool isChannelValid() const;
+	std::shared_ptr<PyTschirpSynthCapabilities::Location const> location() const; // nullptr if there is no synth
 
-	std::shared_ptr<midikraft::Patch> patch_;
+	std::shared_ptr<PyTschirpPatchSlot> slot_; // Shared by all copies and layer views of this patch, but not by clones
 	std::weak_ptr<midikraft::Synth> synth_;
+	std::shared_ptr<PyTschirpParameterIndex> index_; // Resolved once, the patch never changes its type
+	std::shared_ptr<PyTschirpSynthCapabilities> synthCapabilities_; // nullptr if there is no synth
 	int layerNo_ = -1; // -1 means no layer is selected, access the whole patch. Else, this is the layer number this Tschirp represents
+	std::shared_ptr<LiveEditState> live_ = std::make_shared<LiveEditState>();
+};
+
+// Python context manager for "with patch.batch():"
+class PyTschirpBatch {
+public:
+	PyTschirpBatch(PyTschirp const &patch);
+
+	PyTschirp enter();
+	void exit(pybind11::object excType, pybind11::object excValue, pybind11::object traceback);
+
+private:
+	PyTschirp patch_;
 };
 
@@ -0,0 +1,304 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "PyTschirpPatchArchive.h"
+
+#include "PyTschirpParallel.h"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+// All structs are written as they are in memory, so the fields are laid out to need no padding. Integers are little endian
+struct PyTschirpPatchArchive::Header {
+	char magic[8];
+	uint32_t version;
+	uint32_t synthCount;
+	uint32_t fingerprintVersion; // PyTschirpFingerprint::kVersion of the writer
+	uint32_t reserved;
+	uint64_t patchCount;
+	uint64_t synthTableOffset;
+	uint64_t recordsOffset;
+	uint64_t indexOffset;
+	uint64_t namesOffset;
+	uint64_t dataOffset;
+};
+
+struct PyTschirpPatchArchive::Record {
+	uint64_t dataOffset; // Relative to Header::dataOffset
+	uint32_t dataSize;
+	uint32_t synth; // Position in the synth table
+	uint64_t fingerprintHigh;
+	uint64_t fingerprintLow;
+	uint32_t nameOffset; // Relative to Header::namesOffset
+	uint32_t nameLength;
+};
+
+struct PyTschirpPatchArchive::IndexEntry {
+	uint64_t fingerprintHigh;
+	uint64_t fingerprintLow;
+	uint64_t record;
+};
+
+static char const kMagic[8] = { 'P', 'Y', 'T', 'S', 'C', 'H', 'L', 'B' };
+static const uint32_t kVersion = 2;
+static const size_t kSynthNameSize = 64; // One synth table entry, the name is zero padded
+
+size_t PyTschirpPatchArchive::write(std::string const &filename, std::vector<PyTschirp> const &patches, int threads)
+{
+	static_assert(sizeof(Header) == 72 && sizeof(Record) == 40 && sizeof(IndexEntry) == 24, "Archive structs must not contain padding");
+	if (ByteOrder::isBigEndian()) {
+		throw std::runtime_error("PyTschirp: Patch archives are only supported on little endian machines");
+	}
+
+	// Names need the synth, so collect them with the GIL held
+	std::vector<std::shared_ptr<midikraft::Patch>> toWrite;
+	std::vector<std::string> names;
+	std::vector<uint32_t> synthOfPatch;
+	std::vector<std::string> synthNames;
+	std::map<std::string, uint32_t> synthIndex;
+	for (auto const &tschirp : patches) {
+		auto synth = tschirp.synthPtr();
+		if (!synth) {
+			throw std::runtime_error("PyTschirp: Can't archive a patch that does not belong to a synth");
+		}
+		auto synthName = synth->getName();
+		if (synthName.size() >= kSynthNameSize) {
+			throw std::runtime_error("PyTschirp: Synth name too long for patch archive: " + synthName);
+		}
+		auto found = synthIndex.find(synthName);
+		if (found == synthIndex.end()) {
+			found = synthIndex.emplace(synthName, (uint32_t)synthNames.size()).first;
+			synthNames.push_back(synthName);
+		}
+		synthOfPatch.push_back(found->second);
+		toWrite.push_back(tschirp.patchPtr());
+		names.push_back(synth->nameForPatch(tschirp.patchPtr()));
+	}
+
+	pybind11::gil_scoped_release release;
+	std::vector<PyTschirpFingerprint> fingerprints(toWrite.size());
+	parallelForEach((int)toWrite.size(), threads, [&toWrite, &synthOfPatch, &synthNames, &fingerprints](int index) {
+		fingerprints[index] = PyTschirpFingerprint::forPatch(toWrite[index], synthNames[synthOfPatch[index]]);
+	});
+
+	Header header;
+	memcpy(header.magic, kMagic, sizeof(kMagic));
+	header.version = kVersion;
+	header.synthCount = (uint32_t)synthNames.size();
+	header.fingerprintVersion = PyTschirpFingerprint::kVersion;
+	header.reserved = 0;
+	header.patchCount = toWrite.size();
+	header.synthTableOffset = sizeof(Header);
+	header.recordsOffset = header.synthTableOffset + synthNames.size() * kSynthNameSize;
+	header.indexOffset = header.recordsOffset + toWrite.size() * sizeof(Record);
+	header.namesOffset = header.indexOffset + toWrite.size() * sizeof(IndexEntry);
+	uint64_t namesSize = 0;
+	for (auto const &name : names) {
+		namesSize += name.size();
+	}
+	header.dataOffset = header.namesOffset + namesSize;
+
+	std::vector<Record> records;
+	std::vector<IndexEntry> index;
+	uint64_t dataOffset = 0;
+	uint32_t nameOffset = 0;
+	for (size_t i = 0; i < toWrite.size(); i++) {
+		auto dataSize = toWrite[i]->data().size();
+		records.push_back({ dataOffset, (uint32_t)dataSize, synthOfPatch[i], fingerprints[i].high, fingerprints[i].low, nameOffset, (uint32_t)names[i].size() });
+		index.push_back({ fingerprints[i].high, fingerprints[i].low, (uint64_t)i });
+		dataOffset += dataSize;
+		nameOffset += (uint32_t)names[i].size();
+	}
+	std::sort(index.begin(), index.end(), [](IndexEntry const &a, IndexEntry const &b) {
+		return a.fingerprintHigh < b.fingerprintHigh || (a.fingerprintHigh == b.fingerprintHigh && a.fingerprintLow < b.fingerprintLow);
+	});
+
+	juce::TemporaryFile tempFile{ juce::File(filename) };
+	{
+		juce::FileOutputStream stream(tempFile.getFile(), 1 << 20);
+		if (stream.failedToOpen()) {
+			throw std::runtime_error("PyTschirp: Failed to open patch archive " + filename + " for writing");
+		}
+		stream.write(&header, sizeof(header));
+		for (auto const &synthName : synthNames) {
+			char entry[kSynthNameSize] = { 0 };
+			memcpy(entry, synthName.data(), synthName.size());
+			stream.write(entry, sizeof(entry));
+		}
+		stream.write(records.data(), records.size() * sizeof(Record));
+		stream.write(index.data(), index.size() * sizeof(IndexEntry));
+		for (auto const &name : names) {
+			stream.write(name.data(), name.size());
+		}
+		for (auto const &patch : toWrite) {
+			auto const &data = patch->data();
+			stream.write(data.data(), data.size());
+		}
+		stream.flush();
+		if (stream.getStatus().failed()) {
+			throw std::runtime_error("PyTschirp: Failed to write patch archive " + filename);
+		}
+	}
+	if (!tempFile.overwriteTargetFileWithTemporary()) {
+		throw std::runtime_error("PyTschirp: Failed to write patch archive " + filename);
+	}
+	return (size_t)(header.dataOffset + dataOffset);
+}
+
+PyTschirpPatchArchive::PyTschirpPatchArchive(std::string const &filename, std::weak_ptr<midikraft::Synth> synth) : synth_(synth), filename_(filename)
+{
+	if (ByteOrder::isBigEndian()) {
+		throw std::runtime_error("PyTschirp: Patch archives are only supported on little endian machines");
+	}
+	file_ = std::make_shared<juce::MemoryMappedFile>(File(filename), juce::MemoryMappedFile::readOnly);
+	if (!file_->getData() || file_->getSize() < sizeof(Header)) {
+		throw std::runtime_error("PyTschirp: Failed to open patch archive " + filename);
+	}
+
+	Header header;
+	memcpy(&header, file_->getData(), sizeof(header));
+	if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kVersion) {
+		throw std::runtime_error("PyTschirp: " + filename + " is not a patch archive or has an unsupported version");
+	}
+	if (header.patchCount > file_->getSize() / sizeof(Record)) {
+		throw std::runtime_error("PyTschirp: Patch archive " + filename + " is corrupt");
+	}
+	fingerprintVersion_ = header.fingerprintVersion;
+	patchCount_ = header.patchCount;
+	recordsOffset_ = header.recordsOffset;
+	indexOffset_ = header.indexOffset;
+	namesOffset_ = header.namesOffset;
+	dataOffset_ = header.dataOffset;
+	// Make sure the tables are inside the file, the data and names are checked when accessed
+	at(recordsOffset_, patchCount_ * sizeof(Record));
+	at(indexOffset_, patchCount_ * sizeof(IndexEntry));
+
+	auto synthTable = reinterpret_cast<char const *>(at(header.synthTableOffset, (uint64_t)header.synthCount * kSynthNameSize));
+	auto lockedSynth = synth.lock();
+	for (uint32_t i = 0; i < header.synthCount; i++) {
+		auto entry = synthTable + i * kSynthNameSize;
+		synthNames_.emplace_back(entry, strnlen(entry, kSynthNameSize));
+		if (lockedSynth && synthNames_.back() == lockedSynth->getName()) {
+			ownSynth_ = (int)i;
+		}
+	}
+}
+
+int PyTschirpPatchArchive::size() const
+{
+	return (int)patchCount_;
+}
+
+PyTschirp PyTschirpPatchArchive::patch(int index) const
+{
+	auto r = record(index);
+	auto synth = synth_.lock();
+	if (!synth) {
+		throw std::runtime_error("PyTschirp: Synth expired, can't create patch from archive");
+	}
+	if ((int)r.synth != ownSynth_) {
+		throw std::runtime_error("PyTschirp: Patch " + std::to_string(index) + " in archive is for the " + synthNames_[r.synth] + ", open the archive with that synth");
+	}
+	auto data = at(dataOffset_ + r.dataOffset, r.dataSize);
+	auto patch = synth->patchFromPatchData(midikraft::Synth::PatchData(data, data + r.dataSize), MidiProgramNumber::fromZeroBase(index));
+	if (!patch) {
+		throw std::runtime_error("PyTschirp: Synth failed to create patch from archive data");
+	}
+	return PyTschirp(patch, synth_);
+}
+
+std::string PyTschirpPatchArchive::name(int index) const
+{
+	auto r = record(index);
+	return std::string(reinterpret_cast<char const *>(at(namesOffset_ + r.nameOffset, r.nameLength)), r.nameLength);
+}
+
+std::string PyTschirpPatchArchive::synthName(int index) const
+{
+	return synthNames_[record(index).synth];
+}
+
+std::string PyTschirpPatchArchive::fingerprint(int index) const
+{
+	checkFingerprintVersion();
+	auto r = record(index);
+	return PyTschirpFingerprint{ r.fingerprintHigh, r.fingerprintLow }.toString();
+}
+
+int PyTschirpPatchArchive::find(std::string const &fingerprint) const
+{
+	checkFingerprintVersion();
+	if (fingerprint.size() != 32) {
+		return -1;
+	}
+	uint64_t high = std::stoull(fingerprint.substr(0, 16), nullptr, 16);
+	uint64_t low = std::stoull(fingerprint.substr(16), nullptr, 16);
+
+	// Binary search in the index, reading the entries straight from the mapped file
+	auto entries = at(indexOffset_, patchCount_ * sizeof(IndexEntry));
+	uint64_t first = 0;
+	uint64_t last = patchCount_;
+	while (first < last) {
+		uint64_t middle = first + (last - first) / 2;
+		IndexEntry entry;
+		memcpy(&entry, entries + middle * sizeof(IndexEntry), sizeof(entry));
+		if (entry.fingerprintHigh == high && entry.fingerprintLow == low) {
+			return (int)entry.record;
+		}
+		if (entry.fingerprintHigh < high || (entry.fingerprintHigh == high && entry.fingerprintLow < low)) {
+			first = middle + 1;
+		}
+		else {
+			last = middle;
+		}
+	}
+	return -1;
+}
+
+std::vector<std::string> PyTschirpPatchArchive::names() const
+{
+	std::vector<std::string> result;
+	result.reserve((size_t)patchCount_);
+	for (int i = 0; i < size(); i++) {
+		result.push_back(name(i));
+	}
+	return result;
+}
+
+PyTschirpPatchArchive::Record PyTschirpPatchArchive::record(int index) const
+{
+	checkIndex(index);
+	Record result;
+	memcpy(&result, at(recordsOffset_ + (uint64_t)index * sizeof(Record), sizeof(Record)), sizeof(Record));
+	if (result.synth >= synthNames_.size()) {
+		throw std::runtime_error("PyTschirp: Patch archive " + filename_ + " is corrupt");
+	}
+	return result;
+}
+
+void PyTschirpPatchArchive::checkFingerprintVersion() const
+{
+	if (fingerprintVersion_ != PyTschirpFingerprint::kVersion) {
+		throw std::runtime_error("PyTschirp: The fingerprints in patch archive " + filename_ + " are computed differently from this version of PyTschirp, write the archive again");
+	}
+}
+
+void PyTschirpPatchArchive::checkIndex(int index) const
+{
+	if (index < 0 || (uint64_t)index >= patchCount_) {
+		throw std::runtime_error("PyTschirp: Patch index out of range for archive");
+	}
+}
+
+uint8 const *PyTschirpPatchArchive::at(uint64_t offset, uint64_t length) const
+{
+	uint64_t size = file_->getSize();
+	if (offset > size || length > size - offset) {
+		throw std::runtime_error("PyTschirp: Patch archive " + filename_ + " is corrupt");
+	}
+	return static_cast<uint8 const *>(file_->getData()) + offset;
+}
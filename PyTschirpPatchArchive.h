@@ -0,0 +1,55 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "Synth.h"
+
+#include "PyTschirpPatch.h"
+#include "PyTschirpFingerprint.h"
+
+// A binary file of patches that opens without parsing anything. The file starts with a header (including the version of the fingerprints),
+// followed by a table of synth names, one fixed size record per patch (synth, name, fingerprint and where its data is), an index of the
+// records sorted by fingerprint, the names and finally the raw patch data. Opening memory maps the file and only checks the header, a patch is created from its
+// data only when it is accessed.
+class PyTschirpPatchArchive {
+public:
+	PyTschirpPatchArchive(std::string const &filename, std::weak_ptr<midikraft::Synth> synth);
+
+	// Patches of several synths can go into one archive. Returns the number of bytes written
+	static size_t write(std::string const &filename, std::vector<PyTschirp> const &patches, int threads);
+
+	int size() const;
+	PyTschirp patch(int index) const; // Only for patches of the synth the archive was opened with
+	std::string name(int index) const;
+	std::string synthName(int index) const;
+	std::string fingerprint(int index) const;
+	int find(std::string const &fingerprint) const; // Index of a patch with this fingerprint, or -1
+
+	std::vector<std::string> names() const;
+
+private:
+	struct Header;
+	struct Record;
+	struct IndexEntry;
+
+	Record record(int index) const;
+	void checkFingerprintVersion() const; // Stored fingerprints can only be compared to those of the same version
+	void checkIndex(int index) const;
+	uint8 const *at(uint64_t offset, uint64_t length) const;
+
+	std::shared_ptr<juce::MemoryMappedFile> file_;
+	std::weak_ptr<midikraft::Synth> synth_;
+	std::string filename_;
+	std::vector<std::string> synthNames_;
+	int ownSynth_ = -1; // Position of the archive's synth in synthNames_, -1 if the archive has no patches of it
+	uint32_t fingerprintVersion_ = 0;
+	uint64_t patchCount_ = 0;
+	uint64_t recordsOffset_ = 0;
+	uint64_t indexOffset_ = 0;
+	uint64_t namesOffset_ = 0;
+	uint64_t dataOffset_ = 0;
+};
@@ -0,0 +1,163 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "PyTschirpPatchBank.h"
+
+#include <algorithm>
+
+namespace py = pybind11;
+
+PyTschirpPatchBank::PyTschirpPatchBank(std::vector<std::shared_ptr<midikraft::Patch>> const &patches, std::weak_ptr<midikraft::Synth> synth) : patches_(patches), synth_(synth)
+{
+	if (patches_.empty()) {
+		return;
+	}
+
+	// The columns are determined by the first patch, all others must be of the same type
+	index_ = PyTschirpParameterIndex::forPatch(patches_[0]);
+	for (auto const &patch : patches_) {
+		if (PyTschirpParameterIndex::forPatch(patch) != index_) {
+			throw std::runtime_error("PyTschirp: Patch is of a different type than the first patch of the bank");
+		}
+	}
+	int column = 0;
+	for (auto handle : index_->patchHandles()) {
+		auto const &caps = handle->capabilities();
+		// The multi layer parameters get one column per layer, named like in the PatchLibrary
+		std::string name = caps.def->name();
+		if (handle->layerNo() >= 0) {
+			name += "@" + std::to_string(handle->layerNo());
+		}
+		if (caps.isVector)
+		{
+			std::vector<int> value;
+			if (caps.vectorParam && handle->valueInPatch(*patches_[0], value)) {
+				params_.push_back({ handle, column, (int)value.size(), true });
+				for (size_t i = 0; i < value.size(); i++) {
+					columnNames_.push_back(name + "[" + std::to_string(i) + "]");
+				}
+				column += (int)value.size();
+			}
+		}
+		else if (caps.intParam) {
+			params_.push_back({ handle, column, 1, false });
+			columnNames_.push_back(name);
+			column++;
+		}
+	}
+	refresh();
+}
+
+int PyTschirpPatchBank::size() const
+{
+	return (int)patches_.size();
+}
+
+std::vector<std::string> PyTschirpPatchBank::columnNames() const
+{
+	return columnNames_;
+}
+
+py::array_t<int> PyTschirpPatchBank::matrix()
+{
+	py::ssize_t rows = (py::ssize_t) patches_.size();
+	py::ssize_t columns = (py::ssize_t) columnNames_.size();
+	// Using the Python object of this bank as base keeps the bank alive as long as the array exists
+	return py::array_t<int>({ rows, columns }, { columns * (py::ssize_t) sizeof(int), (py::ssize_t) sizeof(int) }, values_.data(), py::cast(this, py::return_value_policy::reference));
+}
+
+py::array_t<int> PyTschirpPatchBank::column(std::string const &name)
+{
+	return matrix()[py::make_tuple(py::slice(py::none(), py::none(), py::none()), columnIndex(name))].cast<py::array_t<int>>();
+}
+
+void PyTschirpPatchBank::refresh()
+{
+	size_t columns = columnNames_.size();
+	values_.assign(patches_.size() * columns, 0);
+	for (size_t row = 0; row < patches_.size(); row++) {
+		auto const &patch = *patches_[row];
+		int *rowValues = values_.data() + row * columns;
+		for (auto const &param : params_) {
+			if (param.isVector) {
+				std::vector<int> value;
+				if (param.handle->valueInPatch(patch, value)) {
+					std::copy_n(value.cbegin(), std::min((int)value.size(), param.width), rowValues + param.firstColumn);
+				}
+			}
+			else {
+				int value;
+				if (param.handle->valueInPatch(patch, value)) {
+					rowValues[param.firstColumn] = value;
+				}
+			}
+		}
+	}
+}
+
+void PyTschirpPatchBank::writeBack()
+{
+	writeParameters(params_);
+}
+
+void PyTschirpPatchBank::writeBackColumns(std::vector<std::string> const &columnNames)
+{
+	// A vector parameter is always written as a whole, so we just need to find the parameters the columns belong to
+	std::vector<Parameter> params;
+	for (auto const &name : columnNames) {
+		int column = columnIndex(name);
+		auto param = std::find_if(params_.cbegin(), params_.cend(), [column](Parameter const &p) { return column >= p.firstColumn && column < p.firstColumn + p.width; });
+		if (std::none_of(params.cbegin(), params.cend(), [param](Parameter const &p) { return p.handle == param->handle; })) {
+			params.push_back(*param);
+		}
+	}
+	writeParameters(params);
+}
+
+PyTschirp PyTschirpPatchBank::patch(int index)
+{
+	if (index < 0 || index >= size()) {
+		throw std::runtime_error("PyTschirp: Patch index out of range for bank");
+	}
+	return PyTschirp(patches_[index], synth_);
+}
+
+std::vector<PyTschirp> PyTschirpPatchBank::patches()
+{
+	std::vector<PyTschirp> result;
+	for (auto patch : patches_) {
+		result.emplace_back(patch, synth_);
+	}
+	return result;
+}
+
+void PyTschirpPatchBank::writeParameters(std::vector<Parameter> const &params)
+{
+	size_t columns = columnNames_.size();
+	for (size_t row = 0; row < patches_.size(); row++) {
+		// The bank owns its patches and writes into them in place, clones made of them must not see that
+		PyTschirpPatchSlot::detachClones(patches_[row]);
+		auto &patch = *patches_[row];
+		int const *rowValues = values_.data() + row * columns;
+		for (auto const &param : params) {
+			if (param.isVector) {
+				param.handle->setInPatch(patch, std::vector<int>(rowValues + param.firstColumn, rowValues + param.firstColumn + param.width));
+			}
+			else {
+				param.handle->setInPatch(patch, rowValues[param.firstColumn]);
+			}
+		}
+	}
+}
+
+int PyTschirpPatchBank::columnIndex(std::string const &name) const
+{
+	auto found = std::find(columnNames_.cbegin(), columnNames_.cend(), name);
+	if (found == columnNames_.cend()) {
+		throw std::runtime_error("PyTschirp: Unknown column name " + name);
+	}
+	return (int)std::distance(columnNames_.cbegin(), found);
+}
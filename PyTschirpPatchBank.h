@@ -0,0 +1,66 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "Synth.h"
+#include "Patch.h"
+#include "SynthParameterDefinition.h"
+
+#ifdef _MSC_VER
+#pragma warning ( push )
+#pragma warning ( disable: 4100 )
+#endif
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+#include "PyTschirpPatch.h"
+#include "PyTschirpParameterIndex.h"
+
+// A bank of patches of the same synth, with all parameter values decoded into one patches x parameters int matrix.
+// Vector parameters like the sequencer tracks use one column per element, named e.g. "Seq Track 1[3]". Multi layer parameters have one column
+// per layer, named e.g. "Cutoff@1" for the second layer
+class PyTschirpPatchBank {
+public:
+	PyTschirpPatchBank(std::vector<std::shared_ptr<midikraft::Patch>> const &patches, std::weak_ptr<midikraft::Synth> synth);
+
+	int size() const;
+	std::vector<std::string> columnNames() const;
+
+	// Zero copy view into the matrix, modifications are written into the patches only by writeBack()
+	pybind11::array_t<int> matrix();
+	pybind11::array_t<int> column(std::string const &name);
+
+	// Read all values again from the patches, e.g. after modifying a patch individually. These don't need the GIL, and different banks
+	// can be processed from several threads, but the multi layer parameters of one synth are accessed by one thread at a time
+	void refresh();
+	void writeBack();
+	void writeBackColumns(std::vector<std::string> const &columnNames);
+
+	PyTschirp patch(int index);
+	std::vector<PyTschirp> patches();
+
+private:
+	struct Parameter {
+		PyTschirpParameterIndex::Handle const *handle; // Owned by index_
+		int firstColumn;
+		int width;
+		bool isVector;
+	};
+
+	void writeParameters(std::vector<Parameter> const &params);
+	int columnIndex(std::string const &name) const;
+
+	std::vector<std::shared_ptr<midikraft::Patch>> patches_;
+	std::weak_ptr<midikraft::Synth> synth_;
+	std::shared_ptr<PyTschirpParameterIndex> index_;
+	std::vector<Parameter> params_;
+	std::vector<std::string> columnNames_;
+	std::vector<int> values_; // Row major, one row per patch
+};
@@ -0,0 +1,265 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "PyTschirpPatchGenerator.h"
+
+#include "PyTschirpParallel.h"
+#include "PyTschirpHelpers.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef _MSC_VER
+#pragma warning ( push )
+#pragma warning ( disable: 4100 )
+#endif
+#include <pybind11/stl.h>
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+namespace py = pybind11;
+
+PyTschirpPatchGenerator::PyTschirpPatchGenerator(PyTschirp const &base, py::object seed)
+{
+	synth_ = base.synthPtr();
+	if (synth_.expired()) {
+		throw std::runtime_error("PyTschirp: The base patch of a generator must belong to a synth");
+	}
+	auto patch = base.patchPtr();
+	baseData_ = patch->data();
+	index_ = PyTschirpParameterIndex::forPatch(patch);
+	for (auto handle : index_->patchHandles()) {
+		auto const &caps = handle->capabilities();
+		if (caps.isVector ? !caps.vectorParam : !caps.intParam) {
+			continue;
+		}
+		// The vector parameters of midikraft implement the int capability as well for the range of their elements
+		int minValue = caps.intParam ? caps.intParam->minValue() : 0;
+		int maxValue = caps.intParam ? caps.intParam->maxValue() : 127;
+		if (maxValue < minValue) {
+			continue;
+		}
+		auto type = caps.def->type();
+		bool isLookup = type == midikraft::SynthParameterDefinition::ParamType::LOOKUP || type == midikraft::SynthParameterDefinition::ParamType::LOOKUP_ARRAY;
+		params_.push_back({ handle, isLookup, minValue, maxValue });
+	}
+
+	if (seed.is_none()) {
+		std::random_device device;
+		setSeed(((uint64_t)device() << 32) | device());
+	}
+	else {
+		setSeed(seed.cast<uint64_t>());
+	}
+}
+
+void PyTschirpPatchGenerator::setSeed(uint64_t seed)
+{
+	seeds_.seed(seed);
+}
+
+std::vector<PyTschirp> PyTschirpPatchGenerator::randomize(int count, std::vector<std::string> const &exclude, int threads)
+{
+	auto excluded = selectParameters(exclude);
+	return generate(baseData_, count, threads, [this, &excluded](midikraft::Patch &target, int item, std::mt19937_64 &random) {
+		ignoreUnused(item);
+		for (size_t i = 0; i < params_.size(); i++) {
+			if (excluded[i]) {
+				continue;
+			}
+			auto const &param = params_[i];
+			std::uniform_int_distribution<int> value(param.minValue, param.maxValue);
+			if (param.handle->capabilities().isVector) {
+				std::vector<int> values;
+				if (param.handle->valueInPatch(target, values)) {
+					for (auto &v : values) {
+						v = value(random);
+					}
+					param.handle->setInPatch(target, values);
+				}
+			}
+			else {
+				param.handle->setInPatch(target, value(random));
+			}
+		}
+	});
+}
+
+std::vector<PyTschirp> PyTschirpPatchGenerator::mutate(PyTschirp const &patch, int count, double rate, double amount, py::object rates, int threads)
+{
+	checkPatchType(patch);
+	std::vector<double> paramRates(params_.size(), rate);
+	if (!rates.is_none()) {
+		for (auto item : rates.cast<py::dict>()) {
+			auto name = item.first.cast<std::string>();
+			auto selected = selectParameters({ name });
+			for (size_t i = 0; i < params_.size(); i++) {
+				if (selected[i]) {
+					paramRates[i] = item.second.cast<double>();
+				}
+			}
+		}
+	}
+
+	return generate(patch.patchPtr()->data(), count, threads, [this, &paramRates, amount](midikraft::Patch &target, int item, std::mt19937_64 &random) {
+		ignoreUnused(item);
+		std::uniform_real_distribution<double> chance(0.0, 1.0);
+		std::normal_distribution<double> offset(0.0, 1.0);
+		for (size_t i = 0; i < params_.size(); i++) {
+			if (paramRates[i] <= 0.0) {
+				continue;
+			}
+			auto const &param = params_[i];
+			double sigma = amount * (param.maxValue - param.minValue);
+			auto mutated = [&](int value) {
+				if (chance(random) >= paramRates[i]) {
+					return value;
+				}
+				if (param.isLookup) {
+					return std::uniform_int_distribution<int>(param.minValue, param.maxValue)(random);
+				}
+				auto result = value + (int)std::lround(offset(random) * sigma);
+				return std::max(param.minValue, std::min(param.maxValue, result));
+			};
+			if (param.handle->capabilities().isVector) {
+				std::vector<int> values;
+				if (param.handle->valueInPatch(target, values)) {
+					for (auto &v : values) {
+						v = mutated(v);
+					}
+					param.handle->setInPatch(target, values);
+				}
+			}
+			else {
+				int value;
+				if (param.handle->valueInPatch(target, value)) {
+					param.handle->setInPatch(target, mutated(value));
+				}
+			}
+		}
+	});
+}
+
+std::vector<PyTschirp> PyTschirpPatchGenerator::interpolate(PyTschirp const &a, PyTschirp const &b, int count, int threads)
+{
+	checkPatchType(a);
+	checkPatchType(b);
+
+	// Decode both end points once, every vector parameter with the elements both patches have
+	std::vector<std::vector<int>> from(params_.size()), to(params_.size());
+	auto patchA = a.patchPtr();
+	auto patchB = b.patchPtr();
+	for (size_t i = 0; i < params_.size(); i++) {
+		auto handle = params_[i].handle;
+		if (handle->capabilities().isVector) {
+			if (handle->valueInPatch(*patchA, from[i]) && handle->valueInPatch(*patchB, to[i])) {
+				size_t elements = std::min(from[i].size(), to[i].size());
+				from[i].resize(elements);
+				to[i].resize(elements);
+			}
+			else {
+				from[i].clear();
+			}
+		}
+		else {
+			int valueA, valueB;
+			if (handle->valueInPatch(*patchA, valueA) && handle->valueInPatch(*patchB, valueB)) {
+				from[i] = { valueA };
+				to[i] = { valueB };
+			}
+		}
+	}
+
+	return generate(patchA->data(), count, threads, [this, &from, &to, count](midikraft::Patch &target, int item, std::mt19937_64 &random) {
+		ignoreUnused(random);
+		double t = count > 1 ? item / (double)(count - 1) : 0.0;
+		for (size_t i = 0; i < params_.size(); i++) {
+			if (from[i].empty()) {
+				continue;
+			}
+			auto const &param = params_[i];
+			std::vector<int> values(from[i].size());
+			for (size_t e = 0; e < values.size(); e++) {
+				if (param.isLookup) {
+					values[e] = t < 0.5 ? from[i][e] : to[i][e];
+				}
+				else {
+					values[e] = from[i][e] + (int)std::lround((to[i][e] - from[i][e]) * t);
+				}
+			}
+			if (param.handle->capabilities().isVector) {
+				param.handle->setInPatch(target, values);
+			}
+			else {
+				param.handle->setInPatch(target, values[0]);
+			}
+		}
+	});
+}
+
+std::vector<PyTschirp> PyTschirpPatchGenerator::generate(midikraft::Synth::PatchData const &source, int count, int threads, Modifier const &modify)
+{
+	if (count < 0) {
+		throw std::runtime_error("PyTschirp: Number of patches to generate must not be negative");
+	}
+	auto synth = synth_.lock();
+	if (!synth) {
+		throw std::runtime_error("PyTschirp: Synth of the generator has expired");
+	}
+
+	uint64_t callSeed = seeds_();
+	std::vector<std::shared_ptr<midikraft::Patch>> created(count);
+	{
+		py::gil_scoped_release release;
+		int tasks = (count + kPatchesPerTask - 1) / kPatchesPerTask;
+		parallelForEach(tasks, threads, [&](int task) {
+			// Spreads neighbouring task numbers over the whole seed space
+			std::mt19937_64 random(splitMix64(callSeed + (uint64_t)task));
+			int end = std::min(count, (task + 1) * kPatchesPerTask);
+			for (int item = task * kPatchesPerTask; item < end; item++) {
+				auto patch = std::dynamic_pointer_cast<midikraft::Patch>(synth->patchFromPatchData(source, MidiProgramNumber::fromZeroBase(0)));
+				if (!patch) {
+					throw std::runtime_error("PyTschirp: Program error: Synth failed to create patch from patch data");
+				}
+				modify(*patch, item, random);
+				created[item] = patch;
+			}
+		});
+	}
+
+	std::vector<PyTschirp> result;
+	result.reserve(created.size());
+	for (auto const &patch : created) {
+		result.emplace_back(patch, synth_);
+	}
+	return result;
+}
+
+std::vector<bool> PyTschirpPatchGenerator::selectParameters(std::vector<std::string> const &names) const
+{
+	std::vector<bool> selected(params_.size(), false);
+	for (auto const &name : names) {
+		int paramIndex = index_->indexOf(name);
+		if (paramIndex == -1) {
+			throw std::runtime_error("PyTschirp: Unknown parameter name " + name);
+		}
+		// Applies to all layers of the parameter
+		for (size_t i = 0; i < params_.size(); i++) {
+			if (params_[i].handle->index() == paramIndex) {
+				selected[i] = true;
+			}
+		}
+	}
+	return selected;
+}
+
+void PyTschirpPatchGenerator::checkPatchType(PyTschirp const &patch) const
+{
+	if (PyTschirpParameterIndex::forPatch(patch.patchPtr()) != index_) {
+		throw std::runtime_error("PyTschirp: Patch is of a different type than the base patch of the generator");
+	}
+}
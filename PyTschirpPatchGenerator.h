@@ -0,0 +1,70 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "Synth.h"
+#include "Patch.h"
+
+#ifdef _MSC_VER
+#pragma warning ( push )
+#pragma warning ( disable: 4100 )
+#endif
+#include <pybind11/pybind11.h>
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+#include "PyTschirpPatch.h"
+#include "PyTschirpParameterIndex.h"
+
+#include <functional>
+#include <random>
+
+// Creates many new patches at once from a base patch, by setting the parameter values directly via the handles of the parameter index
+// instead of going through Python attribute access. Every parameter value stays in the range the synth's definition gives for it.
+// The patches are created on several threads in fixed chunks, each chunk with its own random generator seeded from the generator's
+// sequence, so a given seed produces the same patches no matter how many threads are used
+class PyTschirpPatchGenerator {
+public:
+	// seed None seeds from the system's random device
+	PyTschirpPatchGenerator(PyTschirp const &base, pybind11::object seed);
+
+	void setSeed(uint64_t seed);
+
+	// count copies of the base patch, with all parameter values not excluded drawn uniformly from their range
+	std::vector<PyTschirp> randomize(int count, std::vector<std::string> const &exclude, int threads);
+
+	// count variations of the given patch. Each value is changed with probability rate, by a gaussian offset with a standard deviation of amount
+	// times the parameter's range. Lookup values have no meaningful order, so they get a new random entry instead. rates optionally maps
+	// parameter names to their own rate, e.g. 0 to keep a parameter
+	std::vector<PyTschirp> mutate(PyTschirp const &patch, int count, double rate, double amount, pybind11::object rates, int threads);
+
+	// count patches evenly spaced from a to b, including both. Lookup values switch from a to b half way
+	std::vector<PyTschirp> interpolate(PyTschirp const &a, PyTschirp const &b, int count, int threads);
+
+private:
+	static const int kPatchesPerTask = 256;
+
+	struct Parameter {
+		PyTschirpParameterIndex::Handle const *handle; // Owned by index_
+		bool isLookup;
+		int minValue;
+		int maxValue;
+	};
+
+	typedef std::function<void(midikraft::Patch &patch, int item, std::mt19937_64 &random)> Modifier;
+
+	std::vector<PyTschirp> generate(midikraft::Synth::PatchData const &source, int count, int threads, Modifier const &modify);
+	std::vector<bool> selectParameters(std::vector<std::string> const &names) const; // One flag per parameter in params_
+	void checkPatchType(PyTschirp const &patch) const;
+
+	std::weak_ptr<midikraft::Synth> synth_;
+	midikraft::Synth::PatchData baseData_;
+	std::shared_ptr<PyTschirpParameterIndex> index_;
+	std::vector<Parameter> params_;
+	std::mt19937_64 seeds_; // Produces one seed per call to generate()
+};
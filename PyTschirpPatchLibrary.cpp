@@ -0,0 +1,284 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "PyTschirpPatchLibrary.h"
+
+#include "PyTschirpParallel.h"
+
+#include <algorithm>
+#include <queue>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PYTSCHIRP_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(PYTSCHIRP_X86) && (defined(__GNUC__) || defined(__clang__))
+// Compile only this function for AVX2, the rest of the module must still run on older CPUs
+#define PYTSCHIRP_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define PYTSCHIRP_TARGET_AVX2
+#endif
+
+#ifdef _MSC_VER
+#pragma warning ( push )
+#pragma warning ( disable: 4100 )
+#endif
+#include <pybind11/stl.h>
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+namespace py = pybind11;
+
+static float distanceScalar(float const *a, float const *b, float const *weights, int count)
+{
+	float sum = 0.0f;
+	for (int i = 0; i < count; i++) {
+		float diff = a[i] - b[i];
+		sum += weights[i] * diff * diff;
+	}
+	return sum;
+}
+
+#ifdef PYTSCHIRP_X86
+PYTSCHIRP_TARGET_AVX2 static float distanceAvx2(float const *a, float const *b, float const *weights, int count)
+{
+	// count is a multiple of 8, the padding has weight 0
+	__m256 sum = _mm256_setzero_ps();
+	for (int i = 0; i < count; i += 8) {
+		__m256 diff = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+		sum = _mm256_fmadd_ps(_mm256_mul_ps(diff, diff), _mm256_loadu_ps(weights + i), sum);
+	}
+	__m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+	half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+	half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+	return _mm_cvtss_f32(half);
+}
+#endif
+
+bool PyTschirpPatchLibrary::hasAvx2()
+{
+#if defined(PYTSCHIRP_X86) && (defined(__GNUC__) || defined(__clang__))
+	static bool result = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	return result;
+#elif defined(PYTSCHIRP_X86) && defined(_MSC_VER)
+	static bool result = []() {
+		int info[4];
+		__cpuid(info, 1);
+		bool osSavesYmm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && ((_xgetbv(0) & 6) == 6);
+		bool fma = (info[2] & (1 << 12)) != 0;
+		__cpuidex(info, 7, 0);
+		bool avx2 = (info[1] & (1 << 5)) != 0;
+		return osSavesYmm && fma && avx2;
+	}();
+	return result;
+#else
+	return false;
+#endif
+}
+
+PyTschirpPatchLibrary::PyTschirpPatchLibrary(std::vector<PyTschirp> const &patches) : patches_(patches)
+{
+	if (patches_.empty()) {
+		index_ = PyTschirpParameterIndex::forPatch(nullptr);
+		return;
+	}
+
+	// The dimensions are determined by the first patch, all others must be of the same type
+	auto first = patches_[0].patchPtr();
+	index_ = PyTschirpParameterIndex::forPatch(first);
+	for (auto const &patch : patches_) {
+		if (PyTschirpParameterIndex::forPatch(patch.patchPtr()) != index_) {
+			throw std::runtime_error("PyTschirp: Patch is of a different type than the first patch of the library");
+		}
+	}
+	int dimension = 0;
+	for (auto handle : index_->patchHandles()) {
+		auto const &caps = handle->capabilities();
+		std::string name = caps.def->name();
+		if (handle->layerNo() >= 0) {
+			name += "@" + std::to_string(handle->layerNo());
+		}
+		int width = 0;
+		if (caps.isVector) {
+			std::vector<int> value;
+			if (caps.vectorParam && handle->valueInPatch(*first, value)) {
+				width = (int)value.size();
+				for (int i = 0; i < width; i++) {
+					dimensionNames_.push_back(name + "[" + std::to_string(i) + "]");
+				}
+			}
+		}
+		else if (caps.intParam) {
+			width = 1;
+			dimensionNames_.push_back(name);
+		}
+		if (width > 0) {
+			// The vector parameters of midikraft implement the int capability as well for the range of their elements
+			float minValue = caps.intParam ? (float)caps.intParam->minValue() : 0.0f;
+			float maxValue = caps.intParam ? (float)caps.intParam->maxValue() : 127.0f;
+			params_.push_back({ handle, dimension, width, minValue, maxValue > minValue ? 1.0f / (maxValue - minValue) : 0.0f });
+			dimension += width;
+		}
+	}
+	stride_ = (dimension + kLanes - 1) / kLanes * kLanes;
+
+	std::vector<std::shared_ptr<midikraft::Patch>> toProject;
+	for (auto const &tschirp : patches_) {
+		toProject.push_back(tschirp.patchPtr());
+	}
+	vectors_.assign(patches_.size() * stride_, 0.0f);
+	{
+		py::gil_scoped_release release;
+		int tasks = ((int)toProject.size() + kRowsPerTask - 1) / kRowsPerTask;
+		parallelForEach(tasks, 0, [this, &toProject](int task) {
+			int end = std::min((int)toProject.size(), (task + 1) * kRowsPerTask);
+			for (int row = task * kRowsPerTask; row < end; row++) {
+				auto vector = project(*toProject[row]);
+				std::copy(vector.cbegin(), vector.cend(), vectors_.begin() + (size_t)row * stride_);
+			}
+		});
+	}
+}
+
+int PyTschirpPatchLibrary::size() const
+{
+	return (int)patches_.size();
+}
+
+PyTschirp PyTschirpPatchLibrary::patch(int index) const
+{
+	if (index < 0 || index >= size()) {
+		throw std::runtime_error("PyTschirp: Patch index out of range for library");
+	}
+	return patches_[index];
+}
+
+std::vector<std::string> PyTschirpPatchLibrary::dimensionNames() const
+{
+	return dimensionNames_;
+}
+
+py::list PyTschirpPatchLibrary::nearest(PyTschirp const &patch, int k, py::object weights, int threads)
+{
+	if (PyTschirpParameterIndex::forPatch(patch.patchPtr()) != index_) {
+		throw std::runtime_error("PyTschirp: Patch is of a different type than the patches in the library");
+	}
+
+	std::vector<float> dimensionWeights(stride_, 0.0f);
+	std::fill(dimensionWeights.begin(), dimensionWeights.begin() + dimensionNames_.size(), 1.0f);
+	if (!weights.is_none()) {
+		for (auto item : weights.cast<py::dict>()) {
+			auto name = item.first.cast<std::string>();
+			auto weight = item.second.cast<float>();
+			int paramIndex = index_->indexOf(name);
+			if (paramIndex == -1) {
+				throw std::runtime_error("PyTschirp: Unknown parameter name " + name + " in weights");
+			}
+			// Applies to all elements and all layers of the parameter
+			for (auto const &param : params_) {
+				if (param.handle->index() == paramIndex) {
+					std::fill_n(dimensionWeights.begin() + param.firstDimension, param.width, weight);
+				}
+			}
+		}
+	}
+
+	std::vector<std::pair<int, float>> found;
+	{
+		auto query = project(*patch.patchPtr());
+		py::gil_scoped_release release;
+		found = nearestIndexes(query, dimensionWeights, k, threads);
+	}
+
+	py::list result;
+	for (auto const &hit : found) {
+		result.append(py::make_tuple(py::cast(patches_[hit.first]), hit.second));
+	}
+	return result;
+}
+
+std::vector<std::pair<int, float>> PyTschirpPatchLibrary::nearestIndexes(std::vector<float> const &query, std::vector<float> const &weights, int k, int threads) const
+{
+	if (k <= 0 || patches_.empty()) {
+		return {};
+	}
+
+	auto distance = distanceScalar;
+#ifdef PYTSCHIRP_X86
+	if (hasAvx2()) {
+		distance = distanceAvx2;
+	}
+#endif
+
+	// Every task keeps its own k best in a max heap, and the heaps are merged at the end
+	auto byDistance = [](std::pair<int, float> const &a, std::pair<int, float> const &b) { return a.second < b.second || (a.second == b.second && a.first < b.first); };
+	typedef std::priority_queue<std::pair<int, float>, std::vector<std::pair<int, float>>, decltype(byDistance)> Heap;
+	int tasks = ((int)patches_.size() + kRowsPerTask - 1) / kRowsPerTask;
+	std::vector<Heap> best(tasks, Heap(byDistance));
+	auto search = [&](int task) {
+		auto &heap = best[task];
+		int end = std::min((int)patches_.size(), (task + 1) * kRowsPerTask);
+		for (int row = task * kRowsPerTask; row < end; row++) {
+			float d = distance(vectors_.data() + (size_t)row * stride_, query.data(), weights.data(), stride_);
+			if ((int)heap.size() < k) {
+				heap.emplace(row, d);
+			}
+			else if (d < heap.top().second) {
+				heap.pop();
+				heap.emplace(row, d);
+			}
+		}
+	};
+	if (tasks == 1) {
+		search(0);
+	}
+	else {
+		parallelForEach(tasks, threads, search);
+	}
+
+	std::vector<std::pair<int, float>> result;
+	for (auto &heap : best) {
+		while (!heap.empty()) {
+			result.push_back(heap.top());
+			heap.pop();
+		}
+	}
+	std::sort(result.begin(), result.end(), byDistance);
+	if ((int)result.size() > k) {
+		result.resize(k);
+	}
+	return result;
+}
+
+std::vector<float> PyTschirpPatchLibrary::project(midikraft::Patch const &patch) const
+{
+	std::vector<float> result(stride_, 0.0f);
+	std::vector<int> vectorValue;
+	for (auto const &param : params_) {
+		float *out = result.data() + param.firstDimension;
+		if (param.handle->capabilities().isVector) {
+			vectorValue.clear();
+			if (param.handle->valueInPatch(patch, vectorValue)) {
+				int width = std::min(param.width, (int)vectorValue.size());
+				for (int i = 0; i < width; i++) {
+					out[i] = (vectorValue[i] - param.minValue) * param.scale;
+				}
+			}
+		}
+		else {
+			int value;
+			if (param.handle->valueInPatch(patch, value)) {
+				*out = (value - param.minValue) * param.scale;
+			}
+		}
+	}
+	return result;
+}
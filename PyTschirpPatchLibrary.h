@@ -0,0 +1,61 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "Patch.h"
+
+#ifdef _MSC_VER
+#pragma warning ( push )
+#pragma warning ( disable: 4100 )
+#endif
+#include <pybind11/pybind11.h>
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+#include "PyTschirpPatch.h"
+#include "PyTschirpParameterIndex.h"
+
+// Similarity search over a list of patches. Each patch is projected once into a vector of floats, with every parameter value
+// scaled to 0..1 by the parameter's range, and all vectors are stored in one contiguous block. The search computes the weighted
+// squared euclidean distance to every patch with AVX2 if the CPU has it, and spreads large libraries over several threads
+class PyTschirpPatchLibrary {
+public:
+	PyTschirpPatchLibrary(std::vector<PyTschirp> const &patches);
+
+	int size() const;
+	PyTschirp patch(int index) const;
+	std::vector<std::string> dimensionNames() const;
+
+	// The k patches most similar to the given one, closest first, as (patch, distance) tuples. weights optionally maps parameter
+	// names to a weight, parameters not listed keep weight 1. A patch that is part of the library will find itself at distance 0
+	pybind11::list nearest(PyTschirp const &patch, int k, pybind11::object weights, int threads);
+
+	// Bindings not for python
+	std::vector<std::pair<int, float>> nearestIndexes(std::vector<float> const &query, std::vector<float> const &weights, int k, int threads) const;
+	std::vector<float> project(midikraft::Patch const &patch) const;
+	static bool hasAvx2();
+
+private:
+	static const int kLanes = 8; // Floats per AVX2 register, every vector is padded to a multiple of this
+	static const int kRowsPerTask = 8192;
+
+	struct Parameter {
+		PyTschirpParameterIndex::Handle const *handle; // Owned by index_
+		int firstDimension;
+		int width;
+		float minValue;
+		float scale; // 1 / (max - min), 0 if the range is empty
+	};
+
+	std::vector<PyTschirp> patches_;
+	std::shared_ptr<PyTschirpParameterIndex> index_;
+	std::vector<Parameter> params_;
+	std::vector<std::string> dimensionNames_;
+	int stride_ = 0; // Floats per patch including the padding
+	std::vector<float> vectors_; // Row major, one row of stride_ floats per patch
+};
@@ -0,0 +1,154 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "PyTschirpPatchSlot.h"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <set>
+
+namespace {
+
+	// One lock for all slots, it protects patch_ and isClone_ of every slot, and the clones registered per patch.
+	// The copies are made outside of it
+	std::mutex sLock;
+	std::map<midikraft::Patch const *, std::set<PyTschirpPatchSlot *>> sClones;
+
+}
+
+PyTschirpPatchSlot::PyTschirpPatchSlot(std::shared_ptr<midikraft::Patch> patch, std::weak_ptr<midikraft::Synth> synth) : patch_(patch), synth_(synth)
+{
+}
+
+PyTschirpPatchSlot::~PyTschirpPatchSlot()
+{
+	std::lock_guard<std::mutex> guard(sLock);
+	unregisterClone();
+}
+
+std::shared_ptr<PyTschirpPatchSlot> PyTschirpPatchSlot::clone() const
+{
+	if (synth_.expired()) {
+		throw std::runtime_error("PyTschirp: Can't clone a patch that does not belong to a synth");
+	}
+	std::lock_guard<std::mutex> guard(sLock);
+	auto result = std::make_shared<PyTschirpPatchSlot>(patch_, synth_);
+	result->isClone_ = true;
+	sClones[patch_.get()].insert(result.get());
+	return result;
+}
+
+std::shared_ptr<midikraft::Patch> PyTschirpPatchSlot::patch() const
+{
+	std::lock_guard<std::mutex> guard(sLock);
+	return patch_;
+}
+
+std::shared_ptr<midikraft::Patch> PyTschirpPatchSlot::pinnedPatch()
+{
+	std::lock_guard<std::mutex> guard(sLock);
+	if (std::find(pinned_.cbegin(), pinned_.cend(), patch_) == pinned_.cend()) {
+		pinned_.push_back(patch_);
+	}
+	return patch_;
+}
+
+std::shared_ptr<midikraft::Patch> PyTschirpPatchSlot::writablePatch()
+{
+	while (true) {
+		std::shared_ptr<midikraft::Patch> shared;
+		bool isClone;
+		{
+			std::lock_guard<std::mutex> guard(sLock);
+			if (isClone_ && patch_.use_count() == 1) {
+				// Our own reference is the only one left, the patch just becomes ours
+				unregisterClone();
+				return patch_;
+			}
+			shared = patch_;
+			isClone = isClone_;
+		}
+
+		if (!isClone) {
+			// Owners write in place, after moving the clones away
+			if (shared) {
+				detachClones(shared);
+			}
+			return shared;
+		}
+
+		// Clones take a copy, made without holding the lock
+		auto copy = copyPatch(shared, synth_);
+		std::lock_guard<std::mutex> guard(sLock);
+		if (patch_ == shared) {
+			unregisterClone();
+			patch_ = copy;
+			return patch_;
+		}
+		// An owner has moved us to another copy in the meantime, try again with that one
+	}
+}
+
+std::shared_ptr<midikraft::Patch> PyTschirpPatchSlot::copyPatch() const
+{
+	return copyPatch(patch(), synth_);
+}
+
+void PyTschirpPatchSlot::detachClones(std::shared_ptr<midikraft::Patch> const &patch)
+{
+	std::weak_ptr<midikraft::Synth> synth;
+	{
+		std::lock_guard<std::mutex> guard(sLock);
+		auto clones = sClones.find(patch.get());
+		if (clones == sClones.end()) {
+			return;
+		}
+		synth = (*clones->second.begin())->synth_;
+	}
+
+	// All clones of the patch are clones of the same state, so they can share one copy
+	auto copy = copyPatch(patch, synth);
+
+	std::lock_guard<std::mutex> guard(sLock);
+	auto clones = sClones.find(patch.get());
+	if (clones == sClones.end()) {
+		return;
+	}
+	auto moved = std::move(clones->second);
+	sClones.erase(clones);
+	for (auto clone : moved) {
+		clone->patch_ = copy;
+	}
+	sClones[copy.get()] = std::move(moved);
+}
+
+void PyTschirpPatchSlot::unregisterClone()
+{
+	if (isClone_) {
+		auto clones = sClones.find(patch_.get());
+		if (clones != sClones.end()) {
+			clones->second.erase(this);
+			if (clones->second.empty()) {
+				sClones.erase(clones);
+			}
+		}
+		isClone_ = false;
+	}
+}
+
+std::shared_ptr<midikraft::Patch> PyTschirpPatchSlot::copyPatch(std::shared_ptr<midikraft::Patch> const &patch, std::weak_ptr<midikraft::Synth> const &synth)
+{
+	auto lockedSynth = synth.lock();
+	if (!lockedSynth) {
+		throw std::runtime_error("PyTschirp: Can't copy a patch that does not belong to a synth");
+	}
+	auto copy = std::dynamic_pointer_cast<midikraft::Patch>(lockedSynth->patchFromPatchData(patch->data(), MidiProgramNumber::fromZeroBase(0)));
+	if (!copy) {
+		throw std::runtime_error("PyTschirp: Program error: Synth failed to create patch from patch data");
+	}
+	return copy;
+}
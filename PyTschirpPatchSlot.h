@@ -0,0 +1,43 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "Synth.h"
+#include "Patch.h"
+
+#include <vector>
+
+// Holds the midikraft::Patch of a PyTschirp, shared by all copies and layer views of it. Clones made with clone() share the same
+// midikraft::Patch until it is written to. The patch itself belongs to its owners, i.e. every slot not created by clone() and everybody
+// else holding it like a PatchBank or the host, and the owners always write into it in place. Before they do, all clones still sharing
+// it are moved to a copy. A clone that writes gets its own copy instead, unless nobody else holds the patch anymore, and then becomes
+// the owner of that copy.
+class PyTschirpPatchSlot {
+public:
+	PyTschirpPatchSlot(std::shared_ptr<midikraft::Patch> patch, std::weak_ptr<midikraft::Synth> synth);
+	~PyTschirpPatchSlot();
+
+	std::shared_ptr<PyTschirpPatchSlot> clone() const; // A new slot sharing the patch, the patch must belong to a synth
+
+	std::shared_ptr<midikraft::Patch> patch() const; // For reading only
+	std::shared_ptr<midikraft::Patch> pinnedPatch(); // Like patch(), but the slot keeps the patch alive for views into its data
+	std::shared_ptr<midikraft::Patch> writablePatch(); // Never changes again for an owner, so views into the data stay valid
+
+	std::shared_ptr<midikraft::Patch> copyPatch() const; // An independent copy of the current data, created by the synth
+
+	// Owners not using a slot must call this before they modify a patch that might have been cloned
+	static void detachClones(std::shared_ptr<midikraft::Patch> const &patch);
+
+private:
+	void unregisterClone(); // sLock must be held, turns a clone into an owner
+	static std::shared_ptr<midikraft::Patch> copyPatch(std::shared_ptr<midikraft::Patch> const &patch, std::weak_ptr<midikraft::Synth> const &synth);
+
+	std::shared_ptr<midikraft::Patch> patch_;
+	bool isClone_ = false; // Guarded by the lock of all slots, see the .cpp
+	std::vector<std::shared_ptr<midikraft::Patch>> pinned_; // Same
+	std::weak_ptr<midikraft::Synth> synth_;
+};
@@ -0,0 +1,126 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "PyTschirpStats.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace py = pybind11;
+
+// Histogram buckets are powers of two in nanoseconds, bucket i counts latencies below 2^i ns
+static const int kNumBuckets = 40;
+
+struct TimerStats {
+	std::atomic<uint64_t> count;
+	std::atomic<uint64_t> totalNs;
+	std::atomic<uint64_t> maxNs;
+	std::atomic<uint64_t> buckets[kNumBuckets];
+};
+
+struct SentStats {
+	std::atomic<uint64_t> messages;
+	std::atomic<uint64_t> bytes;
+};
+
+static TimerStats sTimers[PyTschirpStats::NUM_TIMERS];
+static const char *sTimerNames[PyTschirpStats::NUM_TIMERS] = { "attributeLookup", "attributeGet", "attributeSet", "replyRoundTrip", "sysexParse" };
+
+static std::mutex sSentLock;
+static std::map<std::string, std::unique_ptr<SentStats>> sSent;
+
+std::atomic<bool> PyTschirpStats::enabled_(false);
+
+void PyTschirpStats::setEnabled(bool enabled)
+{
+	enabled_ = enabled;
+}
+
+void PyTschirpStats::reset()
+{
+	for (auto &timer : sTimers) {
+		timer.count = 0;
+		timer.totalNs = 0;
+		timer.maxNs = 0;
+		for (auto &bucket : timer.buckets) {
+			bucket = 0;
+		}
+	}
+	// The entries stay, countSent() might be using one right now
+	std::lock_guard<std::mutex> guard(sSentLock);
+	for (auto &entry : sSent) {
+		entry.second->messages = 0;
+		entry.second->bytes = 0;
+	}
+}
+
+void PyTschirpStats::recordLatency(Timer timer, uint64_t nanoseconds)
+{
+	auto &stats = sTimers[timer];
+	stats.count.fetch_add(1, std::memory_order_relaxed);
+	stats.totalNs.fetch_add(nanoseconds, std::memory_order_relaxed);
+	uint64_t previousMax = stats.maxNs.load(std::memory_order_relaxed);
+	while (nanoseconds > previousMax && !stats.maxNs.compare_exchange_weak(previousMax, nanoseconds, std::memory_order_relaxed)) {
+	}
+	int bucket = 0;
+	while (bucket < kNumBuckets - 1 && (nanoseconds >> bucket) != 0) {
+		bucket++;
+	}
+	stats.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+void PyTschirpStats::countSent(std::string const &synthName, uint64_t messages, uint64_t bytes)
+{
+	if (!enabled()) {
+		return;
+	}
+	SentStats *stats;
+	{
+		std::lock_guard<std::mutex> guard(sSentLock);
+		auto &entry = sSent[synthName];
+		if (!entry) {
+			entry = std::make_unique<SentStats>();
+		}
+		stats = entry.get();
+	}
+	stats->messages.fetch_add(messages, std::memory_order_relaxed);
+	stats->bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+py::dict PyTschirpStats::asDict()
+{
+	py::dict result;
+	result["enabled"] = enabled();
+	for (int i = 0; i < NUM_TIMERS; i++) {
+		auto const &stats = sTimers[i];
+		py::dict timer;
+		timer["count"] = stats.count.load();
+		timer["totalNs"] = stats.totalNs.load();
+		timer["maxNs"] = stats.maxNs.load();
+		// Only the non empty buckets, as list of (upper bound in ns, count)
+		py::list histogram;
+		for (int bucket = 0; bucket < kNumBuckets; bucket++) {
+			auto count = stats.buckets[bucket].load();
+			if (count > 0) {
+				histogram.append(py::make_tuple(uint64_t(1) << bucket, count));
+			}
+		}
+		timer["histogram"] = histogram;
+		result[sTimerNames[i]] = timer;
+	}
+
+	py::dict sent;
+	std::lock_guard<std::mutex> guard(sSentLock);
+	for (auto const &entry : sSent) {
+		py::dict synth;
+		synth["messages"] = entry.second->messages.load();
+		synth["bytes"] = entry.second->bytes.load();
+		sent[entry.first.c_str()] = synth;
+	}
+	result["sent"] = sent;
+	return result;
+}
@@ -0,0 +1,62 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#ifdef _MSC_VER
+#pragma warning ( push )
+#pragma warning ( disable: 4100 )
+#endif
+#include <pybind11/pybind11.h>
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Counters and latency histograms for the hot paths, readable from Python via stats(). Everything is kept in relaxed atomics,
+// and when the statistics are disabled (the default), each instrumentation point costs only the check of one flag.
+class PyTschirpStats {
+public:
+	enum Timer {
+		ATTRIBUTE_LOOKUP,
+		ATTRIBUTE_GET,
+		ATTRIBUTE_SET,
+		REPLY_ROUND_TRIP,
+		SYSEX_PARSE,
+		NUM_TIMERS
+	};
+
+	static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+	static void setEnabled(bool enabled);
+	static void reset();
+
+	static void recordLatency(Timer timer, uint64_t nanoseconds);
+	static void countSent(std::string const &synthName, uint64_t messages, uint64_t bytes);
+
+	static pybind11::dict asDict();
+
+	class ScopedTimer {
+	public:
+		ScopedTimer(Timer timer) : timer_(timer), active_(enabled()) {
+			if (active_) start_ = std::chrono::steady_clock::now();
+		}
+		~ScopedTimer() {
+			if (active_) recordLatency(timer_, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count());
+		}
+
+	private:
+		Timer timer_;
+		bool active_;
+		std::chrono::steady_clock::time_point start_;
+	};
+
+private:
+	static std::atomic<bool> enabled_;
+};
@@ -16,18 +16,56 @@
 #include "Sysex.h"
 #include "Librarian.h"
 
+#include "PyTschirpParallel.h"
+#include "PyTschirpFuture.h"
+#include "PyTschirpDetection.h"
+#include "PyTschirpMidiSender.h"
+#include "PyTschirpDownloader.h"
+#include "PyTschirpUploader.h"
+#include "PyTschirpSysexReassembler.h"
+#include "PyTschirpStats.h"
+#include "PyTschirpFingerprint.h"
+#include "PyTschirpSysexWriter.h"
+
+#include "MidiController.h"
+
+#include <condition_variable>
+#include <mutex>
+
+#ifdef _MSC_VER
+#pragma warning ( push )
+#pragma warning ( disable: 4100 )
+#endif
+#include <pybind11/stl.h>
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+namespace py = pybind11;
+
+const int PyTschirpSynth::kEditBufferTimeoutMs; // std::chrono binds it to a reference
+
 
 PyTschirpSynth::PyTschirpSynth(std::shared_ptr<midikraft::Synth> synth)
 {
 	synth_ = synth;
+	capabilities_ = PyTschirpSynthCapabilities::forSynth(synth);
+}
+
+void PyTschirpSynth::detect(bool useCache, int timeoutMs)
+{
+	PyTschirpDetection detection(synth_);
+	detection.detect(useCache, timeoutMs);
 }
 
-void PyTschirpSynth::detect()
+py::object PyTschirpSynth::detectAsync(bool useCache, int timeoutMs)
 {
-	std::vector<std::shared_ptr<midikraft::SimpleDiscoverableDevice>> list;
-	list.push_back(std::dynamic_pointer_cast<midikraft::SimpleDiscoverableDevice>(synth_));
-	midikraft::AutoDetection autodetection;
-	autodetection.autoconfigure(list, nullptr);
+	// Work on a copy, the Python object of this synth might be gone before the detection is done
+	PyTschirpSynth self(*this);
+	return runAsFuture([self, useCache, timeoutMs]() mutable {
+		self.detect(useCache, timeoutMs);
+		return std::function<py::object()>([]() { return py::none(); });
+	});
 }
 
 bool PyTschirpSynth::detected()
@@ -48,19 +86,51 @@ PyTschirp PyTschirpSynth::editBuffer()
 	}
 
 	// Let's see if this is possible
-	auto editBufferCapability = midikraft::Capability::hasCapability<midikraft::EditBufferCapability>(synth_);
+	auto editBufferCapability = capabilities_->editBuffer();
 	if (editBufferCapability) {
-		// Block until we get the edit buffer back from the synth!
-		auto request = editBufferCapability->requestEditBufferDump();
-		midikraft::MidiRequest requester(midiOutput(), request, [editBufferCapability](MidiMessage const &message) {
-			//TODO - this does not seem to work for multi-message edit buffer dumps. Who should do the parsing here? 
-			// Note to myself: This needs the count of expected messages in order to make any sense...
-			return editBufferCapability->isEditBufferDump({ message });
+		// Block until we get the edit buffer back from the synth! It can consist of more than one message, so let the reassembler collect them
+		// The last patch sent to the edit buffer tells how many messages its dump has
+		int expectedMessages = 0;
+		capabilities_->accessDeviceState([&](std::shared_ptr<midikraft::Patch> &deviceState) {
+			if (deviceState) {
+				expectedMessages = (int)editBufferCapability->patchToSysex(deviceState).size();
+			}
 		});
+		PyTschirpSysexReassembler reassembler([editBufferCapability](std::vector<MidiMessage> const &messages) {
+			return editBufferCapability->isEditBufferDump(messages);
+		}, expectedMessages);
+		std::mutex lock;
+		std::condition_variable dumpComplete;
+		std::vector<MidiMessage> editBufferMessages;
+		auto input = midiInput();
+		auto handler = midikraft::MidiController::makeOneHandle();
+		midikraft::MidiController::instance()->addMessageHandler(handler, [&](MidiInput *source, MidiMessage const &message) {
+			if (!source || source->getIdentifier() != input.identifier) return;
+			std::lock_guard<std::mutex> guard(lock);
+			if (editBufferMessages.empty() && reassembler.add(message)) {
+				editBufferMessages = reassembler.takeComplete();
+				dumpComplete.notify_one();
+			}
+		});
+		auto request = editBufferCapability->requestEditBufferDump();
+		midikraft::MidiController::instance()->getMidiOutput(midiOutput())->sendMessageNow(request);
+		PyTschirpStats::countSent(synth_->getName(), 1, (uint64_t)request.getRawDataSize());
+		bool received;
+		{
+			PyTschirpStats::ScopedTimer timer(PyTschirpStats::REPLY_ROUND_TRIP);
+			std::unique_lock<std::mutex> guard(lock);
+			received = dumpComplete.wait_for(guard, std::chrono::milliseconds(kEditBufferTimeoutMs), [&editBufferMessages]() { return !editBufferMessages.empty(); });
+		}
+		midikraft::MidiController::instance()->removeMessageHandler(handler);
+		if (!received) {
+			throw std::runtime_error("PyTschirp: Synth did not reply to edit buffer request");
+		}
 
-		auto editBufferMessage = requester.blockForReply();
-
-		auto patches = synth_->loadSysex({ editBufferMessage });
+		midikraft::TPatchVector patches;
+		{
+			PyTschirpStats::ScopedTimer timer(PyTschirpStats::SYSEX_PARSE);
+			patches = synth_->loadSysex(editBufferMessages);
+		}
 		if (patches.empty()) {
 			throw std::runtime_error("PyTschirp: Failed to create edit buffer from reply, program error!");
 		}
@@ -68,7 +138,9 @@ PyTschirp PyTschirpSynth::editBuffer()
 			throw std::runtime_error("PyTschirp: Failed to parse edit buffer, program error!");
 		}
 
-		return PyTschirp(patches[0], synth_);
+		PyTschirp result(patches[0], synth_);
+		result.markAsSentToSynth();
+		return result;
 	}
 	else {
 		std::cerr << "The " << synth_->getName() << " has no capability to recall the edit buffer, failed." << std::endl;
@@ -76,29 +148,207 @@ PyTschirp PyTschirpSynth::editBuffer()
 	}
 }
 
+py::object PyTschirpSynth::editBufferAsync()
+{
+	if (!detected()) {
+		throw std::runtime_error("PyTschirp: Synth hasn't been detected yet - run detect() first and check if it worked");
+	}
+	PyTschirpSynth self(*this);
+	return runAsFuture([self]() mutable {
+		auto editBuffer = std::make_shared<PyTschirp>(self.editBuffer());
+		return std::function<py::object()>([editBuffer]() { return py::cast(*editBuffer); });
+	});
+}
+
+std::vector<PyTschirp> PyTschirpSynth::downloadPrograms(std::vector<int> const &programs, py::object progress, int inFlight, int timeoutMs, int retries)
+{
+	if (!detected()) {
+		throw std::runtime_error("PyTschirp: Synth hasn't been detected yet - run detect() first and check if it worked");
+	}
+
+	midikraft::TPatchVector patches;
+	{
+		py::gil_scoped_release release;
+		PyTschirpDownloader downloader(synth_, midiInput(), midiOutput());
+		auto downloaded = downloader.download(programs, { inFlight, timeoutMs, retries }, [&progress](int done, int total) {
+			if (!progress.is_none()) {
+				py::gil_scoped_acquire acquire;
+				progress(done, total);
+			}
+		});
+		std::copy(downloaded.cbegin(), downloaded.cend(), std::back_inserter(patches));
+	}
+	return toTschirps(patches);
+}
+
+std::vector<PyTschirp> PyTschirpSynth::downloadBank(int bankNo, py::object progress, int inFlight, int timeoutMs, int retries)
+{
+	if (bankNo < 0 || bankNo >= synth_->numberOfBanks()) {
+		throw std::runtime_error("PyTschirp: Invalid bank number");
+	}
+	std::vector<int> programs;
+	for (int i = 0; i < synth_->numberOfPatches(); i++) {
+		programs.push_back(bankNo * synth_->numberOfPatches() + i);
+	}
+	return downloadPrograms(programs, progress, inFlight, timeoutMs, retries);
+}
+
+py::dict PyTschirpSynth::uploadBank(std::vector<PyTschirp> const &patches, int firstProgram, std::string const &checkpoint, int gapMs, int bufferBytes, py::object progress)
+{
+	if (!detected()) {
+		throw std::runtime_error("PyTschirp: Synth hasn't been detected yet - run detect() first and check if it worked");
+	}
+
+	std::vector<std::shared_ptr<midikraft::Patch>> toUpload;
+	for (auto const &tschirp : patches) {
+		toUpload.push_back(tschirp.patchPtr());
+	}
+
+	PyTschirpUploader::Result result;
+	{
+		py::gil_scoped_release release;
+		// Live edits still waiting would otherwise interleave with the program dumps
+		auto sender = PyTschirpMidiSender::forSynth(synth_);
+		sender->flush();
+		PyTschirpUploader uploader(synth_, midiOutput());
+		result = uploader.upload(toUpload, { firstProgram, bufferBytes, gapMs, sender->bytesPerSecond(), checkpoint }, [&progress](int done, int total) {
+			py::gil_scoped_acquire acquire;
+			// Allow Ctrl-C, the checkpoint is written already
+			if (PyErr_CheckSignals() != 0) {
+				throw py::error_already_set();
+			}
+			if (!progress.is_none()) {
+				progress(done, total);
+			}
+		});
+	}
+
+	py::dict dict;
+	dict["sent"] = result.sent;
+	dict["skipped"] = result.skipped;
+	dict["bytes"] = result.bytes;
+	dict["seconds"] = result.seconds;
+	dict["bytesPerSecond"] = result.seconds > 0.0 ? result.bytes / result.seconds : 0.0;
+	return dict;
+}
+
 std::vector<PyTschirp> PyTschirpSynth::loadSysex(std::string const &filename)
 {
 	auto midimessages = Sysex::loadSysex(filename);
-	auto patches = synth_->loadSysex(midimessages);
+	midikraft::TPatchVector patches;
+	{
+		PyTschirpStats::ScopedTimer timer(PyTschirpStats::SYSEX_PARSE);
+		patches = synth_->loadSysex(midimessages);
+	}
+	return toTschirps(patches);
+}
 
-	std::vector<PyTschirp> result;
-	for (auto patch : patches) {
-		result.emplace_back(patch, synth_);
+std::vector<std::vector<PyTschirp>> PyTschirpSynth::loadSysexFiles(std::vector<std::string> const &filenames, int threads, py::object perFile)
+{
+	std::vector<midikraft::TPatchVector> loaded(filenames.size());
+	std::vector<std::vector<PyTschirp>> result(filenames.size());
+	{
+		py::gil_scoped_release release;
+		parallelForEach((int)filenames.size(), threads, [this, &filenames, &loaded](int index) {
+			auto midimessages = Sysex::loadSysex(filenames[index]);
+			PyTschirpStats::ScopedTimer timer(PyTschirpStats::SYSEX_PARSE);
+			loaded[index] = synth_->loadSysex(midimessages);
+		}, [this, &filenames, &loaded, &result, &perFile](int index) {
+			py::gil_scoped_acquire acquire;
+			result[index] = toTschirps(loaded[index]);
+			loaded[index].clear();
+			if (!perFile.is_none()) {
+				perFile(filenames[index], result[index]);
+			}
+		});
 	}
 	return result;
 }
 
-void PyTschirpSynth::saveSysex(std::string const &filename, std::vector <PyTschirp> &patches)
+PyTschirpPatchBank PyTschirpSynth::loadBank(std::string const &filename)
+{
+	auto midimessages = Sysex::loadSysex(filename);
+	midikraft::TPatchVector patches;
+	{
+		PyTschirpStats::ScopedTimer timer(PyTschirpStats::SYSEX_PARSE);
+		patches = synth_->loadSysex(midimessages);
+	}
+
+	std::vector<std::shared_ptr<midikraft::Patch>> bank;
+	for (auto patch : patches) {
+		auto correctPatch = std::dynamic_pointer_cast<midikraft::Patch>(patch);
+		if (correctPatch) {
+			bank.push_back(correctPatch);
+		}
+	}
+	return PyTschirpPatchBank(bank, synth_);
+}
+
+PyTschirpSysexStream PyTschirpSynth::streamSysex(std::string const &filename)
 {
-	auto pdc = midikraft::Capability::hasCapability<midikraft::ProgramDumpCabability>(synth_);
+	return PyTschirpSysexStream(filename, synth_);
+}
+
+PyTschirpPatchArchive PyTschirpSynth::openArchive(std::string const &filename)
+{
+	return PyTschirpPatchArchive(filename, synth_);
+}
+
+py::dict PyTschirpSynth::dedupe(std::vector<PyTschirp> const &patches, int threads)
+{
+	std::vector<std::shared_ptr<midikraft::Patch>> toHash;
+	std::vector<std::string> synthNames;
+	for (auto const &tschirp : patches) {
+		toHash.push_back(tschirp.patchPtr());
+		auto synth = tschirp.synthPtr();
+		synthNames.push_back(synth ? synth->getName() : std::string());
+	}
+
+	PyTschirpDedupe result;
+	{
+		py::gil_scoped_release release;
+		result = PyTschirpDedupe::run(toHash, synthNames, threads);
+	}
+
+	py::list unique;
+	for (int index : result.unique) {
+		unique.append(py::cast(patches[index]));
+	}
+	py::list duplicates;
+	for (auto const &group : result.duplicates) {
+		py::list groupList;
+		for (int index : group) {
+			groupList.append(py::cast(patches[index]));
+		}
+		duplicates.append(groupList);
+	}
+	py::dict dict;
+	dict["unique"] = unique;
+	dict["duplicates"] = duplicates;
+	return dict;
+}
+
+void PyTschirpSynth::saveSysex(std::string const &filename, std::vector<PyTschirp> const &patches, int threads)
+{
+	saveSysexFiles({ { filename, patches } }, threads);
+}
+
+void PyTschirpSynth::saveSysexFiles(std::map<std::string, std::vector<PyTschirp>> const &files, int threads)
+{
+	auto pdc = capabilities_->programDump();
 	if (pdc) {
-		std::vector<MidiMessage> result;
-		int place = 0;
-		for (auto tschirp : patches) {
-			auto m = pdc->patchToProgramDumpSysex(tschirp.patchPtr(), MidiProgramNumber::fromZeroBase(place++));
-			std::copy(m.cbegin(), m.cend(), std::back_inserter(result));
+		std::vector<PyTschirpSysexWriter::SysexFile> toWrite;
+		for (auto const &file : files) {
+			PyTschirpSysexWriter::SysexFile sysexFile{ file.first, {} };
+			sysexFile.patches.reserve(file.second.size());
+			for (auto const &tschirp : file.second) {
+				sysexFile.patches.push_back(tschirp.patchPtr());
+			}
+			toWrite.push_back(std::move(sysexFile));
 		}
-		Sysex::saveSysex(filename, result);
+		py::gil_scoped_release release;
+		PyTschirpSysexWriter writer(pdc);
+		writer.write(toWrite, threads);
 	}
 	else {
 		throw std::runtime_error("PyTschirp: Synth has not implemented the ProgramDumpCapability, consider saving the patches one by one with the saveEditBuffer() function");
@@ -107,7 +357,7 @@ void PyTschirpSynth::saveSysex(std::string const &filename, std::vector <PyTschi
 
 void PyTschirpSynth::saveEditBuffer(std::string const &filename, PyTschirp &patch)
 {
-	auto ebc = midikraft::Capability::hasCapability<midikraft::EditBufferCapability>(synth_);
+	auto ebc = capabilities_->editBuffer();
 	if (ebc) {
 		auto midiMessages = ebc->patchToSysex(patch.patchPtr());
 		Sysex::saveSysex(filename, midiMessages);
@@ -139,20 +389,57 @@ void PyTschirpSynth::getGlobalSettings()
 	midikraft::MidiRequest::blockUntilTrue([&done]() { return done;  }, 2000);
 }
 
+std::vector<PyTschirp> PyTschirpSynth::toTschirps(midikraft::TPatchVector const &patches)
+{
+	std::vector<PyTschirp> result;
+	for (auto patch : patches) {
+		result.emplace_back(patch, synth_);
+	}
+	return result;
+}
+
+void PyTschirpSynth::setSendRate(int bytesPerSecond)
+{
+	PyTschirpMidiSender::forSynth(synth_)->setBytesPerSecond(bytesPerSecond);
+}
+
+int PyTschirpSynth::sendRate()
+{
+	return PyTschirpMidiSender::forSynth(synth_)->bytesPerSecond();
+}
+
+void PyTschirpSynth::flush()
+{
+	PyTschirpMidiSender::forSynth(synth_)->flush();
+}
+
+py::dict PyTschirpSynth::senderStats()
+{
+	auto stats = PyTschirpMidiSender::forSynth(synth_)->stats();
+	py::dict result;
+	result["queueDepth"] = stats.queueDepth;
+	result["droppedUpdates"] = stats.droppedUpdates;
+	result["messagesSent"] = stats.messagesSent;
+	result["bytesSent"] = stats.bytesSent;
+	return result;
+}
+
+void PyTschirpSynth::resetSenderStats()
+{
+	PyTschirpMidiSender::forSynth(synth_)->resetStats();
+}
+
 juce::MidiDeviceInfo PyTschirpSynth::midiInput() const
 {
-	auto midiLocation = midikraft::Capability::hasCapability<midikraft::MidiLocationCapability>(synth_);
-	return midiLocation ? midiLocation->midiInput() : MidiDeviceInfo();
+	return capabilities_->location()->input;
 }
 
 juce::MidiDeviceInfo PyTschirpSynth::midiOutput() const
 {
-	auto midiLocation = midikraft::Capability::hasCapability<midikraft::MidiLocationCapability>(synth_);
-	return midiLocation ? midiLocation->midiOutput() : MidiDeviceInfo();
+	return capabilities_->location()->output;
 }
 
 MidiChannel PyTschirpSynth::channel() const
 {
-	auto midiLocation = midikraft::Capability::hasCapability<midikraft::MidiLocationCapability>(synth_);
-	return midiLocation ? midiLocation->channel() : MidiChannel::invalidChannel();
+	return capabilities_->location()->channel;
 }
@@ -8,31 +8,69 @@
 
 #include "Synth.h"
 
+#include <map>
+
 #include "PyTschirpPatch.h"
+#include "PyTschirpPatchBank.h"
+#include "PyTschirpSysexStream.h"
+#include "PyTschirpPatchArchive.h"
+#include "PyTschirpSynthCapabilities.h"
 
 class PyTschirpSynth {
 public:
 	PyTschirpSynth(std::shared_ptr<midikraft::Synth> synth);
 
-	void detect();
+	void detect(bool useCache, int timeoutMs);
 	bool detected();
+	pybind11::object detectAsync(bool useCache, int timeoutMs);
 
 	std::string location() const;
 
 	PyTschirp editBuffer();
+	pybind11::object editBufferAsync();
+
+	// Download programs from the synth, keeping inFlight requests outstanding at the same time. progress(done, total) is optional
+	std::vector<PyTschirp> downloadPrograms(std::vector<int> const &programs, pybind11::object progress, int inFlight, int timeoutMs, int retries);
+	std::vector<PyTschirp> downloadBank(int bankNo, pybind11::object progress, int inFlight, int timeoutMs, int retries);
+
+	// Store patches in the synth's memory, starting at firstProgram. With a checkpoint file, an interrupted upload resumes where it stopped
+	pybind11::dict uploadBank(std::vector<PyTschirp> const &patches, int firstProgram, std::string const &checkpoint, int gapMs, int bufferBytes, pybind11::object progress);
 
 	std::vector<PyTschirp> loadSysex(std::string const &filename);
-	void saveSysex(std::string const &filename, std::vector <PyTschirp> &patches);
+	// Loads and parses many files on a pool of worker threads with the GIL released. If perFile is given, it is called with
+	// (filename, patches) for each file as soon as that file is done, the result list is in the order of the filenames
+	std::vector<std::vector<PyTschirp>> loadSysexFiles(std::vector<std::string> const &filenames, int threads, pybind11::object perFile);
+	// Finds the patches with identical parameter values, e.g. in the concatenated results of loadSysexFiles(). Returns a dict with the
+	// list of unique patches, and a list of groups of duplicates, each starting with the patch that made it into the unique list
+	pybind11::dict dedupe(std::vector<PyTschirp> const &patches, int threads);
+	// The program dumps are encoded on a pool of worker threads with the GIL released, and streamed to disk in order
+	void saveSysex(std::string const &filename, std::vector<PyTschirp> const &patches, int threads);
+	void saveSysexFiles(std::map<std::string, std::vector<PyTschirp>> const &files, int threads);
+	PyTschirpPatchBank loadBank(std::string const &filename);
+	PyTschirpSysexStream streamSysex(std::string const &filename);
+	PyTschirpPatchArchive openArchive(std::string const &filename);
 
 	void saveEditBuffer(std::string const &filename, PyTschirp &patch);
 
 	void getGlobalSettings();
 
+	// Live edit messages are sent by a background thread, paced to this budget. Use 0 for unlimited, default is the DIN MIDI rate
+	void setSendRate(int bytesPerSecond);
+	int sendRate();
+	void flush();
+	pybind11::dict senderStats();
+	void resetSenderStats();
+
 private:
+	static const int kEditBufferTimeoutMs = 2000;
+
     juce::MidiDeviceInfo midiInput() const;
     juce::MidiDeviceInfo midiOutput() const;
 	MidiChannel channel() const;
 
+	std::vector<PyTschirp> toTschirps(midikraft::TPatchVector const &patches);
+
 	std::shared_ptr<midikraft::Synth> synth_;
+	std::shared_ptr<PyTschirpSynthCapabilities> capabilities_;
 };
 
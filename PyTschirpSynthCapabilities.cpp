@@ -0,0 +1,117 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "PyTschirpSynthCapabilities.h"
+
+#include "Capability.h"
+
+#include <map>
+
+std::shared_ptr<PyTschirpSynthCapabilities> PyTschirpSynthCapabilities::forSynth(std::shared_ptr<midikraft::Synth> synth)
+{
+	static std::mutex lock;
+	static std::map<midikraft::Synth *, std::pair<std::weak_ptr<midikraft::Synth>, std::shared_ptr<PyTschirpSynthCapabilities>>> capabilities;
+
+	std::lock_guard<std::mutex> guard(lock);
+	// Drop the entries of synths that are gone, the address might have been reused
+	for (auto it = capabilities.begin(); it != capabilities.end(); ) {
+		if (it->second.first.expired())
+			it = capabilities.erase(it);
+		else
+			++it;
+	}
+	auto found = capabilities.find(synth.get());
+	if (found != capabilities.end()) {
+		return found->second.second;
+	}
+	std::shared_ptr<PyTschirpSynthCapabilities> result(new PyTschirpSynthCapabilities(synth));
+	capabilities[synth.get()] = std::make_pair(std::weak_ptr<midikraft::Synth>(synth), result);
+	return result;
+}
+
+PyTschirpSynthCapabilities::PyTschirpSynthCapabilities(std::shared_ptr<midikraft::Synth> synth)
+{
+	// Only keep raw pointers, the shared_ptrs returned by hasCapability would keep the synth alive forever
+	midiLocation_ = midikraft::Capability::hasCapability<midikraft::MidiLocationCapability>(synth).get();
+	editBuffer_ = midikraft::Capability::hasCapability<midikraft::EditBufferCapability>(synth).get();
+	programDump_ = midikraft::Capability::hasCapability<midikraft::ProgramDumpCabability>(synth).get();
+}
+
+std::shared_ptr<PyTschirpSynthCapabilities::Location const> PyTschirpSynthCapabilities::location()
+{
+	auto cached = std::atomic_load(&location_);
+	if (cached && isCurrent(*cached)) {
+		return cached;
+	}
+
+	// Read under the lock, so a location read before invalidateLocation() can't overwrite the new one
+	std::lock_guard<std::mutex> guard(lock_);
+	if (location_ && location_ == cached) {
+		// Changed outside of the detection, e.g. by the host application. What has been sent to the old location says nothing about the new one
+		std::atomic_store(&location_, std::shared_ptr<Location const>());
+		std::lock_guard<std::mutex> deviceStateGuard(deviceStateLock_);
+		deviceState_.reset();
+	}
+	else if (location_) {
+		// Somebody else has read it again in the meantime
+		return location_;
+	}
+	auto fresh = std::make_shared<Location>();
+	if (midiLocation_) {
+		fresh->input = midiLocation_->midiInput();
+		fresh->output = midiLocation_->midiOutput();
+		fresh->channel = midiLocation_->channel();
+	}
+	// A synth not detected yet is asked again next time, so a detection by somebody else is picked up
+	if (!midiLocation_ || fresh->channel.isValid()) {
+		std::atomic_store(&location_, std::shared_ptr<Location const>(fresh));
+	}
+	return fresh;
+}
+
+void PyTschirpSynthCapabilities::invalidateLocation()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock_);
+		std::atomic_store(&location_, std::shared_ptr<Location const>());
+	}
+	std::lock_guard<std::mutex> guard(deviceStateLock_);
+	deviceState_.reset();
+}
+
+void PyTschirpSynthCapabilities::accessDeviceState(std::function<void(std::shared_ptr<midikraft::Patch> &)> const &access)
+{
+	std::lock_guard<std::mutex> guard(deviceStateLock_);
+	access(deviceState_);
+}
+
+bool PyTschirpSynthCapabilities::isCurrent(Location const &location) const
+{
+	if (!midiLocation_) {
+		return true;
+	}
+	// Only virtual calls and string compares, the capability itself is resolved already
+	auto channel = midiLocation_->channel();
+	if (channel.isValid() != location.channel.isValid() || (channel.isValid() && channel.toZeroBasedInt() != location.channel.toZeroBasedInt())) {
+		return false;
+	}
+	return midiLocation_->midiOutput().identifier == location.output.identifier && midiLocation_->midiInput().identifier == location.input.identifier;
+}
+
+midikraft::MidiLocationCapability *PyTschirpSynthCapabilities::midiLocation() const
+{
+	return midiLocation_;
+}
+
+midikraft::EditBufferCapability *PyTschirpSynthCapabilities::editBuffer() const
+{
+	return editBuffer_;
+}
+
+midikraft::ProgramDumpCabability *PyTschirpSynthCapabilities::programDump() const
+{
+	return programDump_;
+}
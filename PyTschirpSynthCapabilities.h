@@ -0,0 +1,56 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "Synth.h"
+#include "MidiLocationCapability.h"
+#include "EditBufferCapability.h"
+#include "ProgramDumpCapability.h"
+#include "Patch.h"
+
+#include <functional>
+#include <memory>
+#include <mutex>
+
+// The capabilities of a synth, resolved once instead of with a dynamic cast on every call. The MIDI location is cached as well once it is valid.
+// The detection calls invalidateLocation() whenever it changes the location, and a location changed by somebody else is noticed on the next read.
+// The capability pointers are only valid as long as the synth is alive, so hold a shared_ptr to the synth while using them.
+// It also keeps what the synth's edit buffer has received last. There is only one edit buffer per synth, so this is shared by all patches.
+class PyTschirpSynthCapabilities {
+public:
+	static std::shared_ptr<PyTschirpSynthCapabilities> forSynth(std::shared_ptr<midikraft::Synth> synth);
+
+	struct Location {
+		juce::MidiDeviceInfo input;
+		juce::MidiDeviceInfo output;
+		MidiChannel channel = MidiChannel::invalidChannel();
+	};
+	std::shared_ptr<Location const> location();
+	void invalidateLocation(); // Forgets the device state as well, it might be a different synth now
+
+	// Runs access with the patch last sent to the edit buffer under a lock, nullptr if unknown. access may replace it, or update it in place
+	void accessDeviceState(std::function<void(std::shared_ptr<midikraft::Patch> &)> const &access);
+
+	midikraft::MidiLocationCapability *midiLocation() const; // nullptr if the capability is not implemented, same for the others
+	midikraft::EditBufferCapability *editBuffer() const;
+	midikraft::ProgramDumpCabability *programDump() const;
+
+private:
+	PyTschirpSynthCapabilities(std::shared_ptr<midikraft::Synth> synth);
+
+	bool isCurrent(Location const &location) const; // Still what the synth says
+
+	midikraft::MidiLocationCapability *midiLocation_;
+	midikraft::EditBufferCapability *editBuffer_;
+	midikraft::ProgramDumpCabability *programDump_;
+
+	std::mutex lock_;
+	std::shared_ptr<Location const> location_; // nullptr when it needs to be read from the synth again
+
+	std::mutex deviceStateLock_;
+	std::shared_ptr<midikraft::Patch> deviceState_;
+};
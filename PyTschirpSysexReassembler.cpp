@@ -0,0 +1,112 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "PyTschirpSysexReassembler.h"
+
+PyTschirpSysexReassembler::PyTschirpSysexReassembler(TIsCompleteDump isCompleteDump, int expectedMessages, int maxMessages, size_t capacityBytes) :
+	isCompleteDump_(isCompleteDump), messageCount_(std::max(0, expectedMessages)), buffer_(capacityBytes), spans_((size_t)std::max(1, maxMessages))
+{
+	candidate_.reserve(spans_.size());
+}
+
+bool PyTschirpSysexReassembler::add(MidiMessage const &message)
+{
+	if (!message.isSysEx()) {
+		return false;
+	}
+	size_t length = (size_t)message.getRawDataSize();
+	if (length > buffer_.size()) {
+		// Can't be part of anything we could reassemble
+		reset();
+		return false;
+	}
+
+	// Every message is stored contiguously, wrap around early if it doesn't fit at the end
+	if (writePos_ + length > buffer_.size()) {
+		writePos_ = 0;
+	}
+	while (spanCount_ > 0) {
+		auto const &oldest = spans_[firstSpan_];
+		bool overlaps = oldest.offset < writePos_ + length && oldest.offset + oldest.length > writePos_;
+		if (!overlaps && spanCount_ < spans_.size()) break;
+		dropOldest();
+	}
+	memcpy(buffer_.data() + writePos_, message.getRawData(), length);
+	spans_[(firstSpan_ + spanCount_) % spans_.size()] = { writePos_, length };
+	spanCount_++;
+	writePos_ += length;
+
+	// With the number known there is only one candidate, and only once enough messages have arrived
+	if (messageCount_ > 0 && (size_t)messageCount_ <= spanCount_ && isComplete(messageCount_)) {
+		return true;
+	}
+	// Only try all other lengths if we don't know the number yet, or the known one can't match anymore
+	if (messageCount_ == 0 || spanCount_ == spans_.size()) {
+		return findMessageCount();
+	}
+	return false;
+}
+
+std::vector<MidiMessage> PyTschirpSysexReassembler::takeComplete()
+{
+	std::vector<MidiMessage> result;
+	result.swap(complete_);
+	return result;
+}
+
+void PyTschirpSysexReassembler::reset()
+{
+	firstSpan_ = 0;
+	spanCount_ = 0;
+	writePos_ = 0;
+	complete_.clear();
+}
+
+bool PyTschirpSysexReassembler::isComplete(int messageCount)
+{
+	candidate_.clear();
+	for (size_t i = spanCount_ - (size_t)messageCount; i < spanCount_; i++) {
+		auto const &span = spans_[(firstSpan_ + i) % spans_.size()];
+		candidate_.emplace_back(buffer_.data() + span.offset, (int)span.length);
+	}
+	if (!isCompleteDump_(candidate_)) {
+		return false;
+	}
+	consumeCandidate();
+	return true;
+}
+
+bool PyTschirpSysexReassembler::findMessageCount()
+{
+	// The candidate grows by one message to the front for every length tried, so each message is only created once
+	candidate_.clear();
+	for (int count = 1; count <= (int)spanCount_; count++) {
+		auto const &span = spans_[(firstSpan_ + spanCount_ - (size_t)count) % spans_.size()];
+		candidate_.emplace(candidate_.begin(), buffer_.data() + span.offset, (int)span.length);
+		if (count != messageCount_ && isCompleteDump_(candidate_)) {
+			messageCount_ = count;
+			consumeCandidate();
+			return true;
+		}
+	}
+	return false;
+}
+
+void PyTschirpSysexReassembler::consumeCandidate()
+{
+	complete_.swap(candidate_);
+	candidate_.clear();
+	// The messages are consumed, start fresh for the next dump
+	firstSpan_ = 0;
+	spanCount_ = 0;
+	writePos_ = 0;
+}
+
+void PyTschirpSysexReassembler::dropOldest()
+{
+	firstSpan_ = (firstSpan_ + 1) % spans_.size();
+	spanCount_--;
+}
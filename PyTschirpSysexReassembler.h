@@ -0,0 +1,49 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#include <functional>
+
+// Collects the messages of multi message sysex dumps as they come in. The raw bytes are copied into a preallocated ring buffer,
+// and MidiMessages are only created to ask the capability's predicate if the trailing messages form a complete dump.
+// Once the number of messages of a dump is known, given or learned from the first dump, the predicate is only asked when that many
+// messages have arrived. Until then each message is tried as the end of dumps of all lengths, creating every MidiMessage once.
+class PyTschirpSysexReassembler {
+public:
+	typedef std::function<bool(std::vector<MidiMessage> const &)> TIsCompleteDump;
+
+	// expectedMessages is the number of messages of a dump if known, 0 to learn it
+	PyTschirpSysexReassembler(TIsCompleteDump isCompleteDump, int expectedMessages = 0, int maxMessages = 16, size_t capacityBytes = 65536);
+
+	// Returns true if this message completed a dump, which can then be retrieved with takeComplete()
+	bool add(MidiMessage const &message);
+	std::vector<MidiMessage> takeComplete();
+	void reset();
+
+private:
+	struct Span {
+		size_t offset;
+		size_t length;
+	};
+
+	bool isComplete(int messageCount);
+	bool findMessageCount();
+	void consumeCandidate();
+	void dropOldest();
+
+	TIsCompleteDump isCompleteDump_;
+	int messageCount_; // Of a dump, 0 while unknown
+	std::vector<uint8> buffer_;
+	size_t writePos_ = 0;
+	std::vector<Span> spans_; // Circular, spanCount_ entries starting at firstSpan_
+	size_t firstSpan_ = 0;
+	size_t spanCount_ = 0;
+	std::vector<MidiMessage> candidate_;
+	std::vector<MidiMessage> complete_;
+};
@@ -0,0 +1,76 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "PyTschirpSysexStream.h"
+
+#include "PyTschirpStats.h"
+
+namespace py = pybind11;
+
+PyTschirpSysexStream::PyTschirpSysexStream(std::string const &filename, std::weak_ptr<midikraft::Synth> synth) : synth_(synth)
+{
+	file_ = std::make_shared<juce::MemoryMappedFile>(File(filename), juce::MemoryMappedFile::readOnly);
+	if (!file_->getData()) {
+		throw std::runtime_error("PyTschirp: Failed to open sysex file " + filename);
+	}
+
+	// Find the frame boundaries. Bytes outside of F0 ... F7 are ignored, like the regular sysex loader does
+	auto data = static_cast<uint8 const *>(file_->getData());
+	size_t size = file_->getSize();
+	size_t start = 0;
+	bool inFrame = false;
+	for (size_t i = 0; i < size; i++) {
+		if (data[i] == 0xf0) {
+			start = i;
+			inFrame = true;
+		}
+		else if (data[i] == 0xf7 && inFrame) {
+			frames_.push_back({ start, i - start + 1 });
+			inFrame = false;
+		}
+	}
+}
+
+int PyTschirpSysexStream::messageCount() const
+{
+	return (int)frames_.size();
+}
+
+PyTschirpSysexStream & PyTschirpSysexStream::iter()
+{
+	return *this;
+}
+
+PyTschirp PyTschirpSysexStream::next()
+{
+	auto synth = synth_.lock();
+	if (!synth) {
+		throw std::runtime_error("PyTschirp: Synth expired, can't decode sysex stream");
+	}
+
+	auto data = static_cast<uint8 const *>(file_->getData());
+	while (decoded_.empty() && nextFrame_ < frames_.size()) {
+		auto const &frame = frames_[nextFrame_++];
+		pending_.emplace_back(data + frame.offset, (int)frame.length);
+		PyTschirpStats::ScopedTimer timer(PyTschirpStats::SYSEX_PARSE);
+		auto patches = synth->loadSysex(pending_);
+		if (!patches.empty()) {
+			std::copy(patches.cbegin(), patches.cend(), std::back_inserter(decoded_));
+			pending_.clear();
+		}
+		else if (pending_.size() >= kMaxFramesPerPatch) {
+			// Whatever the oldest frame is, it doesn't start a patch
+			pending_.erase(pending_.begin());
+		}
+	}
+
+	if (decoded_.empty()) {
+		throw py::stop_iteration();
+	}
+	auto patch = decoded_.front();
+	decoded_.pop_front();
+	return PyTschirp(patch, synth_);
+}
@@ -0,0 +1,40 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "Synth.h"
+
+#include "PyTschirpPatch.h"
+
+#include <deque>
+
+// Iterates over the patches in a sysex file without loading it. The file is memory mapped, and only the sysex frame
+// boundaries are determined up front. A patch is decoded only when the iteration reaches it.
+class PyTschirpSysexStream {
+public:
+	PyTschirpSysexStream(std::string const &filename, std::weak_ptr<midikraft::Synth> synth);
+
+	int messageCount() const;
+
+	PyTschirpSysexStream &iter();
+	PyTschirp next();
+
+private:
+	struct Frame {
+		size_t offset;
+		size_t length;
+	};
+
+	static const size_t kMaxFramesPerPatch = 8;
+
+	std::shared_ptr<juce::MemoryMappedFile> file_;
+	std::weak_ptr<midikraft::Synth> synth_;
+	std::vector<Frame> frames_;
+	size_t nextFrame_ = 0;
+	std::vector<MidiMessage> pending_; // Frames of a multi message patch not complete yet
+	std::deque<std::shared_ptr<midikraft::DataFile>> decoded_; // A bank dump message can contain more than one patch
+};
@@ -0,0 +1,133 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "PyTschirpSysexWriter.h"
+
+#include "PyTschirpParallel.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+const int PyTschirpSysexWriter::kPatchesPerChunk; // std::min takes it by reference
+
+PyTschirpSysexWriter::PyTschirpSysexWriter(midikraft::ProgramDumpCabability *programDump) : programDump_(programDump)
+{
+}
+
+size_t PyTschirpSysexWriter::write(std::vector<SysexFile> const &files, int threads)
+{
+	// Chunks of all files go into one list, so the workers stay busy across file boundaries. An empty file still gets one empty chunk
+	std::vector<Chunk> chunks;
+	for (int file = 0; file < (int)files.size(); file++) {
+		int patchCount = (int)files[file].patches.size();
+		int first = 0;
+		do {
+			chunks.push_back({ file, first, std::min(kPatchesPerChunk, patchCount - first), {} });
+			first += kPatchesPerChunk;
+		} while (first < patchCount);
+	}
+
+	// The workers take the chunks in order, and wait before they get too far ahead of the writer. The chunk next in line is never held
+	// back, so the writer always makes progress
+	size_t maxChunksAhead = (size_t)kChunksPerThread * (size_t)(threads > 0 ? threads : defaultThreadCount());
+	std::mutex lock;
+	std::condition_variable chunkWritten;
+	bool failed = false;
+
+	std::vector<bool> encoded(chunks.size(), false);
+	size_t nextToWrite = 0; // Guarded by lock
+	int currentFile = -1;
+	std::unique_ptr<juce::TemporaryFile> tempFile;
+	std::unique_ptr<juce::FileOutputStream> stream;
+	size_t bytesWritten = 0;
+
+	auto finishFile = [&]() {
+		if (stream) {
+			stream->flush();
+			bool ok = !stream->getStatus().failed();
+			stream.reset();
+			if (!ok || !tempFile->overwriteTargetFileWithTemporary()) {
+				throw std::runtime_error("PyTschirp: Failed to write sysex file " + files[currentFile].filename);
+			}
+			tempFile.reset();
+		}
+	};
+
+	auto writeChunk = [&](Chunk &chunk) {
+		if (chunk.file != currentFile) {
+			finishFile();
+			currentFile = chunk.file;
+			tempFile = std::make_unique<juce::TemporaryFile>(juce::File(files[currentFile].filename));
+			stream = std::make_unique<juce::FileOutputStream>(tempFile->getFile(), (size_t)kWriteBufferSize);
+			if (stream->failedToOpen()) {
+				throw std::runtime_error("PyTschirp: Failed to open sysex file " + files[currentFile].filename + " for writing");
+			}
+		}
+		if (!chunk.bytes.empty() && !stream->write(chunk.bytes.data(), chunk.bytes.size())) {
+			throw std::runtime_error("PyTschirp: Failed to write sysex file " + files[currentFile].filename);
+		}
+		bytesWritten += chunk.bytes.size();
+		std::vector<uint8>().swap(chunk.bytes);
+	};
+
+	auto fail = [&]() {
+		std::lock_guard<std::mutex> guard(lock);
+		failed = true;
+		chunkWritten.notify_all();
+	};
+
+	parallelForEach((int)chunks.size(), threads, [&](int index) {
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			chunkWritten.wait(guard, [&]() { return (size_t)index < nextToWrite + maxChunksAhead || failed; });
+			if (failed) {
+				// Nothing after the failed chunk is written anymore
+				return;
+			}
+		}
+		try {
+			encode(files, chunks[index]);
+		}
+		catch (...) {
+			fail();
+			throw;
+		}
+	}, [&](int index) {
+		// Runs on the calling thread, write out everything that is complete and next in line
+		encoded[index] = true;
+		try {
+			while (nextToWrite < chunks.size() && encoded[nextToWrite]) {
+				writeChunk(chunks[nextToWrite]);
+				std::lock_guard<std::mutex> guard(lock);
+				nextToWrite++;
+				chunkWritten.notify_all();
+			}
+		}
+		catch (...) {
+			fail();
+			throw;
+		}
+	});
+	finishFile();
+	return bytesWritten;
+}
+
+void PyTschirpSysexWriter::encode(std::vector<SysexFile> const &files, Chunk &chunk)
+{
+	auto const &patches = files[chunk.file].patches;
+	for (int i = chunk.firstPatch; i < chunk.firstPatch + chunk.patchCount; i++) {
+		auto messages = programDump_->patchToProgramDumpSysex(patches[i], MidiProgramNumber::fromZeroBase(i));
+		for (auto const &message : messages) {
+			if (chunk.bytes.empty()) {
+				// All program dumps of a synth have about the same size
+				chunk.bytes.reserve((size_t)message.getRawDataSize() * messages.size() * chunk.patchCount);
+			}
+			chunk.bytes.insert(chunk.bytes.end(), message.getRawData(), message.getRawData() + message.getRawDataSize());
+		}
+	}
+}
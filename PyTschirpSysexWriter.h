@@ -0,0 +1,44 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "Patch.h"
+#include "ProgramDumpCapability.h"
+
+#include <string>
+#include <vector>
+
+// Encodes patches as program dumps on a pool of worker threads, and streams the bytes to disk in order while the remaining patches
+// are still being encoded. The workers don't get more than a few chunks per thread ahead of the chunk written next, so only that much
+// encoded sysex is held in memory at any time. Each file is first written to a temporary file, which replaces the target only when it is complete
+class PyTschirpSysexWriter {
+public:
+	struct SysexFile {
+		std::string filename;
+		std::vector<std::shared_ptr<midikraft::Patch>> patches; // Stored at program places 0, 1, 2, ...
+	};
+
+	PyTschirpSysexWriter(midikraft::ProgramDumpCabability *programDump);
+
+	size_t write(std::vector<SysexFile> const &files, int threads); // Returns the number of bytes written
+
+private:
+	static const int kPatchesPerChunk = 32;
+	static const int kChunksPerThread = 2; // How far the workers may get ahead of the writer
+	static const int kWriteBufferSize = 1 << 20;
+
+	struct Chunk {
+		int file;
+		int firstPatch;
+		int patchCount;
+		std::vector<uint8> bytes;
+	};
+
+	void encode(std::vector<SysexFile> const &files, Chunk &chunk);
+
+	midikraft::ProgramDumpCabability *programDump_;
+};
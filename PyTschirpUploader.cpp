@@ -0,0 +1,112 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "PyTschirpUploader.h"
+
+#include "PyTschirpStats.h"
+
+#include "Capability.h"
+
+#include <chrono>
+#include <thread>
+
+PyTschirpUploader::PyTschirpUploader(std::shared_ptr<midikraft::Synth> synth, juce::MidiDeviceInfo const &output) : synth_(synth), output_(output)
+{
+	programDump_ = midikraft::Capability::hasCapability<midikraft::ProgramDumpCabability>(synth_);
+	if (!programDump_) {
+		throw std::runtime_error("PyTschirp: Synth has not implemented the ProgramDumpCapability, can't upload programs");
+	}
+}
+
+PyTschirpUploader::Result PyTschirpUploader::upload(std::vector<std::shared_ptr<midikraft::Patch>> const &patches, Options const &options, std::function<void(int, int)> progress)
+{
+	typedef std::chrono::steady_clock Clock;
+
+	// Encode everything first, the hash of the encoded data identifies this upload in the checkpoint file
+	std::vector<std::vector<MidiMessage>> dumps;
+	std::vector<size_t> dumpBytes;
+	MemoryBlock allData;
+	for (size_t i = 0; i < patches.size(); i++) {
+		dumps.push_back(programDump_->patchToProgramDumpSysex(patches[i], MidiProgramNumber::fromZeroBase(options.firstProgram + (int)i)));
+		size_t bytes = 0;
+		for (auto const &message : dumps.back()) {
+			allData.append(message.getRawData(), (size_t)message.getRawDataSize());
+			bytes += (size_t)message.getRawDataSize();
+		}
+		dumpBytes.push_back(bytes);
+	}
+	String uploadId = MD5(allData).toHexString();
+
+	File checkpoint;
+	int completed = 0;
+	if (!options.checkpointFile.empty()) {
+		checkpoint = File(options.checkpointFile);
+		completed = readCheckpoint(checkpoint, uploadId);
+	}
+
+	Result result = { 0, completed, 0, 0.0 };
+	auto start = Clock::now();
+	// How much of the synth's receive buffer is still occupied, it drains at the link speed
+	double bufferFill = 0.0;
+	auto lastSend = start;
+	for (size_t i = (size_t)completed; i < dumps.size(); i++) {
+		if (options.bytesPerSecond > 0) {
+			double room = std::max(options.bufferBytes, (int)dumpBytes[i]) - (double)dumpBytes[i];
+			auto now = Clock::now();
+			bufferFill = std::max(0.0, bufferFill - std::chrono::duration<double>(now - lastSend).count() * options.bytesPerSecond);
+			if (bufferFill > room) {
+				std::this_thread::sleep_for(std::chrono::duration<double>((bufferFill - room) / options.bytesPerSecond));
+				bufferFill = room;
+			}
+			lastSend = Clock::now();
+			bufferFill += (double)dumpBytes[i];
+		}
+
+		synth_->sendBlockOfMessagesToSynth(output_, dumps[i]);
+		PyTschirpStats::countSent(synth_->getName(), dumps[i].size(), dumpBytes[i]);
+		result.sent++;
+		result.bytes += dumpBytes[i];
+
+		// The synth needs time to store the program before it can accept the next one
+		if (options.gapMs > 0 && i + 1 < dumps.size()) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(options.gapMs));
+		}
+
+		if (checkpoint != File()) {
+			writeCheckpoint(checkpoint, uploadId, (int)i + 1);
+		}
+		if (progress) {
+			progress((int)i + 1, (int)dumps.size());
+		}
+	}
+
+	if (checkpoint != File()) {
+		checkpoint.deleteFile();
+	}
+	result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	return result;
+}
+
+int PyTschirpUploader::readCheckpoint(File const &checkpoint, String const &uploadId) const
+{
+	if (!checkpoint.existsAsFile()) {
+		return 0;
+	}
+	auto json = JSON::parse(checkpoint);
+	if (json.getProperty("upload", "").toString() != uploadId) {
+		// Different patches or places, start from the beginning
+		return 0;
+	}
+	return json.getProperty("completed", 0);
+}
+
+void PyTschirpUploader::writeCheckpoint(File const &checkpoint, String const &uploadId, int completed) const
+{
+	auto json = var(new DynamicObject());
+	json.getDynamicObject()->setProperty("upload", uploadId);
+	json.getDynamicObject()->setProperty("completed", completed);
+	checkpoint.replaceWithText(JSON::toString(json));
+}
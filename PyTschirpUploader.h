@@ -0,0 +1,45 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "Synth.h"
+#include "Patch.h"
+#include "ProgramDumpCapability.h"
+
+// Sends program dumps into the synth's memory. Each program dump is sent as a whole, but only when the synth's receive buffer
+// has room for it given the link speed, plus a gap after each program for the synth to store it. With a checkpoint file, an
+// interrupted upload of the same patches to the same places continues after the last program stored.
+class PyTschirpUploader {
+public:
+	struct Options {
+		int firstProgram;
+		int bufferBytes;
+		int gapMs; // Applied after every program, the upload does not wait for any handshake of the synth
+		int bytesPerSecond; // 0 means the link is not the limit
+		std::string checkpointFile; // Empty for no checkpoints
+	};
+
+	struct Result {
+		int sent;
+		int skipped;
+		size_t bytes;
+		double seconds;
+	};
+
+	PyTschirpUploader(std::shared_ptr<midikraft::Synth> synth, juce::MidiDeviceInfo const &output);
+
+	// progress(done, total) is called after each program
+	Result upload(std::vector<std::shared_ptr<midikraft::Patch>> const &patches, Options const &options, std::function<void(int, int)> progress);
+
+private:
+	int readCheckpoint(File const &checkpoint, String const &uploadId) const;
+	void writeCheckpoint(File const &checkpoint, String const &uploadId, int completed) const;
+
+	std::shared_ptr<midikraft::Synth> synth_;
+	std::shared_ptr<midikraft::ProgramDumpCabability> programDump_;
+	juce::MidiDeviceInfo output_;
+};
@@ -9,6 +9,10 @@
 #include "PyTschirpPatch.h"
 #include "PyTschirpAttribute.h"
 #include "PyTschirpSynth.h"
+#include "PyTschirpPatchLibrary.h"
+#include "PyTschirpPatchGenerator.h"
+#include "PyTschirpAutomation.h"
+#include "PyTschirpStats.h"
 
 #include "Rev2.h"
 #include "KawaiK3.h"
@@ -37,20 +41,40 @@ void defineSynth(M m, const char *pythonClassName) {
 	py::class_<SynthInstance<S>> pyTschirpSynth(m, pythonClassName);
 	pyTschirpSynth
 		.def(py::init<>())
-		.def("detect", &PyTschirpSynth::detect)
+		.def("detect", &PyTschirpSynth::detect, py::arg("useCache") = true, py::arg("timeoutMs") = 3000, py::call_guard<py::gil_scoped_release>())
+		.def("detectAsync", &PyTschirpSynth::detectAsync, py::arg("useCache") = true, py::arg("timeoutMs") = 3000)
 		.def("detected", &PyTschirpSynth::detected)
 		.def("location", &PyTschirpSynth::location)
-		.def("editBuffer", &PyTschirpSynth::editBuffer)
+		.def("editBuffer", &PyTschirpSynth::editBuffer, py::call_guard<py::gil_scoped_release>())
+		.def("editBufferAsync", &PyTschirpSynth::editBufferAsync)
+		.def("downloadPrograms", &PyTschirpSynth::downloadPrograms, py::arg("programs"), py::arg("progress") = py::none(), py::arg("inFlight") = 4, py::arg("timeoutMs") = 2000, py::arg("retries") = 2)
+		.def("downloadBank", &PyTschirpSynth::downloadBank, py::arg("bank"), py::arg("progress") = py::none(), py::arg("inFlight") = 4, py::arg("timeoutMs") = 2000, py::arg("retries") = 2)
+		.def("uploadBank", &PyTschirpSynth::uploadBank, py::arg("patches"), py::arg("firstProgram") = 0, py::arg("checkpoint") = "", py::arg("gapMs") = 20, py::arg("bufferBytes") = 1024, py::arg("progress") = py::none())
 		.def("loadSysex", &PyTschirpSynth::loadSysex)
-		.def("saveSysex", &PyTschirpSynth::saveSysex)
+		.def("loadSysexFiles", &PyTschirpSynth::loadSysexFiles, py::arg("filenames"), py::arg("threads") = 0, py::arg("perFile") = py::none())
+		.def("loadBank", &PyTschirpSynth::loadBank)
+		.def("streamSysex", &PyTschirpSynth::streamSysex)
+		.def("openArchive", &PyTschirpSynth::openArchive)
+		.def("dedupe", &PyTschirpSynth::dedupe, py::arg("patches"), py::arg("threads") = 0)
+		.def("saveSysex", &PyTschirpSynth::saveSysex, py::arg("filename"), py::arg("patches"), py::arg("threads") = 0)
+		.def("saveSysexFiles", &PyTschirpSynth::saveSysexFiles, py::arg("files"), py::arg("threads") = 0)
 		.def("saveEditBuffer", &PyTschirpSynth::saveEditBuffer)
-		.def("getGlobalSettings", &PyTschirpSynth::getGlobalSettings);
+		.def("getGlobalSettings", &PyTschirpSynth::getGlobalSettings)
+		.def("setSendRate", &PyTschirpSynth::setSendRate)
+		.def("sendRate", &PyTschirpSynth::sendRate)
+		.def("flush", &PyTschirpSynth::flush, py::call_guard<py::gil_scoped_release>())
+		.def("senderStats", &PyTschirpSynth::senderStats)
+		.def("resetSenderStats", &PyTschirpSynth::resetSenderStats);
 }
 
 PYBIND11_EMBEDDED_MODULE(pytschirpee, m) {
 	m.doc() = "Provide PyTschirp bindings for the KnobKraft Orm";
 
-	py::class_<PyTschirp> rev2_tschirp(m, "Patch");
+	m.def("stats", &PyTschirpStats::asDict);
+	m.def("resetStats", &PyTschirpStats::reset);
+	m.def("enableStats", &PyTschirpStats::setEnabled);
+
+	py::class_<PyTschirp> rev2_tschirp(m, "Patch", py::buffer_protocol());
 	rev2_tschirp.def(py::init<std::shared_ptr<midikraft::Patch>>())
 		.def("attr", &PyTschirp::get_attr)
 		.def("__getattr__", &PyTschirp::get_attr)
@@ -61,17 +85,94 @@ PYBIND11_EMBEDDED_MODULE(pytschirpee, m) {
 		.def("__getitem__", &PyTschirp::get_attr)
 		.def_property("name", &PyTschirp::getName, &PyTschirp::setName)
 		.def("layer", &PyTschirp::layer)
-		.def("parameterNames", &PyTschirp::parameterNames);
+		.def("clone", &PyTschirp::clone)
+		.def("parameterNames", &PyTschirp::parameterNames)
+		.def("fingerprint", &PyTschirp::fingerprint)
+		.def("batch", &PyTschirp::batch)
+		.def("beginBatch", &PyTschirp::beginBatch)
+		.def("commitBatch", &PyTschirp::commitBatch)
+		.def("update", &PyTschirp::update)
+		.def("sync", &PyTschirp::sync)
+		.def_buffer(&PyTschirp::buffer)
+		.def("setData", &PyTschirp::setData);
+
+	py::class_<PyTschirpBatch> batch(m, "Batch");
+	batch
+		.def("__enter__", &PyTschirpBatch::enter)
+		.def("__exit__", &PyTschirpBatch::exit);
 
 	py::class_<PyTschirpAttribute> rev2_attribute(m, "Attribute");
 	rev2_attribute
 		.def("set", py::overload_cast<int>(&PyTschirpAttribute::set))
 		.def("set", py::overload_cast<std::vector<int>>(&PyTschirpAttribute::set))
 		.def("get", &PyTschirpAttribute::get)
+		.def("asArray", &PyTschirpAttribute::asArray)
 		.def("asText", &PyTschirpAttribute::asText)
 		.def("__repr__", &PyTschirpAttribute::asText)
 		;
 
+	py::class_<PyTschirpPatchBank> bank(m, "PatchBank");
+	bank
+		.def("__len__", &PyTschirpPatchBank::size)
+		.def("__getitem__", &PyTschirpPatchBank::patch)
+		.def("columnNames", &PyTschirpPatchBank::columnNames)
+		.def_property_readonly("matrix", &PyTschirpPatchBank::matrix)
+		.def("column", &PyTschirpPatchBank::column)
+		.def("refresh", &PyTschirpPatchBank::refresh, py::call_guard<py::gil_scoped_release>())
+		.def("writeBack", &PyTschirpPatchBank::writeBack, py::call_guard<py::gil_scoped_release>())
+		.def("writeBack", &PyTschirpPatchBank::writeBackColumns, py::call_guard<py::gil_scoped_release>())
+		.def("patch", &PyTschirpPatchBank::patch)
+		.def("patches", &PyTschirpPatchBank::patches);
+
+	m.def("writePatchArchive", &PyTschirpPatchArchive::write, py::arg("filename"), py::arg("patches"), py::arg("threads") = 0);
+
+	py::class_<PyTschirpPatchArchive> archive(m, "PatchArchive");
+	archive
+		.def("__len__", &PyTschirpPatchArchive::size)
+		.def("__getitem__", &PyTschirpPatchArchive::patch)
+		.def("patch", &PyTschirpPatchArchive::patch)
+		.def("name", &PyTschirpPatchArchive::name)
+		.def("names", &PyTschirpPatchArchive::names)
+		.def("synthName", &PyTschirpPatchArchive::synthName)
+		.def("fingerprint", &PyTschirpPatchArchive::fingerprint)
+		.def("find", &PyTschirpPatchArchive::find);
+
+	py::class_<PyTschirpPatchLibrary> library(m, "PatchLibrary");
+	library
+		.def(py::init<std::vector<PyTschirp> const &>())
+		.def("__len__", &PyTschirpPatchLibrary::size)
+		.def("__getitem__", &PyTschirpPatchLibrary::patch)
+		.def("dimensionNames", &PyTschirpPatchLibrary::dimensionNames)
+		.def("nearest", &PyTschirpPatchLibrary::nearest, py::arg("patch"), py::arg("k") = 10, py::arg("weights") = py::none(), py::arg("threads") = 0);
+
+	py::class_<PyTschirpPatchGenerator> generator(m, "PatchGenerator");
+	generator
+		.def(py::init<PyTschirp const &, py::object>(), py::arg("base"), py::arg("seed") = py::none())
+		.def("seed", &PyTschirpPatchGenerator::setSeed)
+		.def("randomize", &PyTschirpPatchGenerator::randomize, py::arg("count"), py::arg("exclude") = std::vector<std::string>(), py::arg("threads") = 0)
+		.def("mutate", &PyTschirpPatchGenerator::mutate, py::arg("patch"), py::arg("count"), py::arg("rate") = 0.1, py::arg("amount") = 0.1, py::arg("rates") = py::none(), py::arg("threads") = 0)
+		.def("interpolate", &PyTschirpPatchGenerator::interpolate, py::arg("a"), py::arg("b"), py::arg("count"), py::arg("threads") = 0);
+
+	py::class_<PyTschirpAutomation> automation(m, "Automation");
+	automation
+		.def(py::init<PyTschirp const &, double>(), py::arg("patch"), py::arg("tickRate") = 100.0)
+		.def("breakpoints", &PyTschirpAutomation::breakpoints, py::arg("name"), py::arg("points"), py::arg("loop") = false)
+		.def("lfo", &PyTschirpAutomation::lfo, py::arg("name"), py::arg("shape") = "sine", py::arg("frequency") = 1.0, py::arg("low") = 0.0, py::arg("high") = 127.0, py::arg("phase") = 0.0, py::arg("duration") = 0.0)
+		.def("morph", &PyTschirpAutomation::morph, py::arg("target"), py::arg("duration"))
+		.def("clear", &PyTschirpAutomation::clear)
+		.def("start", &PyTschirpAutomation::start)
+		.def("stop", &PyTschirpAutomation::stop, py::call_guard<py::gil_scoped_release>())
+		.def("running", &PyTschirpAutomation::running)
+		.def("wait", &PyTschirpAutomation::wait, py::arg("timeoutMs") = -1, py::call_guard<py::gil_scoped_release>())
+		.def("patch", &PyTschirpAutomation::patch)
+		.def("stats", &PyTschirpAutomation::stats);
+
+	py::class_<PyTschirpSysexStream> sysexStream(m, "SysexStream");
+	sysexStream
+		.def("__iter__", &PyTschirpSysexStream::iter, py::return_value_policy::reference_internal)
+		.def("__next__", &PyTschirpSysexStream::next)
+		.def("messageCount", &PyTschirpSysexStream::messageCount);
+
 	defineSynth<midikraft::Rev2>(m, "Rev2");
 	defineSynth<midikraft::KawaiK3>(m, "K3");
 }
@@ -0,0 +1,245 @@
+/*
+   Copyright (c) 2020 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+// Microbenchmarks for the hot paths of the module. Run with --benchmark_out=results.json --benchmark_out_format=json
+// to get a file that can be compared across releases, e.g. with Google Benchmark's tools/compare.py.
+// The K3 benchmarks need a K3 bank sysex file given in the environment variable PYTSCHIRP_BENCH_K3_SYX.
+
+#include "Rev2.h"
+#include "Rev2Patch.h"
+#include "KawaiK3.h"
+
+#include "Capability.h"
+#include "ProgramDumpCapability.h"
+#include "Sysex.h"
+
+#include "PyTschirpPatch.h"
+#include "PyTschirpAttribute.h"
+#include "PyTschirpSynth.h"
+#include "PyTschirpParameterIndex.h"
+#include "PyTschirpPatchLibrary.h"
+#include "PyTschirpPatchGenerator.h"
+
+#ifdef _MSC_VER
+#pragma warning ( push )
+#pragma warning ( disable: 4100 )
+#endif
+#include <pybind11/embed.h>
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+#include <benchmark/benchmark.h>
+
+namespace py = pybind11;
+
+static std::shared_ptr<midikraft::Rev2> rev2()
+{
+	static auto synth = std::make_shared<midikraft::Rev2>();
+	return synth;
+}
+
+static std::shared_ptr<midikraft::Patch> rev2Patch()
+{
+	static auto patch = std::make_shared<midikraft::Rev2Patch>();
+	return patch;
+}
+
+// Synthetic bank of 512 init patches, written once to a temporary file
+static std::string rev2BankFile()
+{
+	static File bankFile;
+	if (bankFile == File()) {
+		bankFile = File::createTempFile(".syx");
+		auto pdc = midikraft::Capability::hasCapability<midikraft::ProgramDumpCabability>(rev2());
+		std::vector<MidiMessage> messages;
+		for (int i = 0; i < 512; i++) {
+			auto m = pdc->patchToProgramDumpSysex(rev2Patch(), MidiProgramNumber::fromZeroBase(i));
+			std::copy(m.cbegin(), m.cend(), std::back_inserter(messages));
+		}
+		Sysex::saveSysex(bankFile.getFullPathName().toStdString(), messages);
+	}
+	return bankFile.getFullPathName().toStdString();
+}
+
+static void BM_ParameterIndexFind(benchmark::State &state)
+{
+	auto patch = rev2Patch();
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(PyTschirpParameterIndex::forPatch(patch)->find("Seq Track 1"));
+	}
+}
+BENCHMARK(BM_ParameterIndexFind);
+
+static void BM_AttributeGetInt(benchmark::State &state)
+{
+	auto patch = rev2Patch();
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(PyTschirpAttribute(patch, "Cutoff").get());
+	}
+}
+BENCHMARK(BM_AttributeGetInt);
+
+static void BM_AttributeSetInt(benchmark::State &state)
+{
+	auto patch = rev2Patch();
+	int value = 0;
+	for (auto _ : state) {
+		PyTschirpAttribute(patch, "Cutoff").set(value++ % 128);
+	}
+}
+BENCHMARK(BM_AttributeSetInt);
+
+static void BM_AttributeGetVector(benchmark::State &state)
+{
+	auto patch = rev2Patch();
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(PyTschirpAttribute(patch, "Seq Track 1").get());
+	}
+}
+BENCHMARK(BM_AttributeGetVector);
+
+static void BM_AttributeSetVector(benchmark::State &state)
+{
+	auto patch = rev2Patch();
+	std::vector<int> track({ 1, 2, 3, 4, 5, 6, 7, 8, 8, 7, 6, 5, 4, 3, 2, 1 });
+	for (auto _ : state) {
+		PyTschirpAttribute(patch, "Seq Track 1").set(track);
+	}
+}
+BENCHMARK(BM_AttributeSetVector);
+
+static void BM_LayerAttributeGet(benchmark::State &state)
+{
+	PyTschirp tschirp(rev2Patch(), rev2());
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(tschirp.layer(1).get_attr("Cutoff").get());
+	}
+}
+BENCHMARK(BM_LayerAttributeGet);
+
+static void BM_ParameterNames(benchmark::State &state)
+{
+	PyTschirp tschirp(rev2Patch(), rev2());
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(tschirp.parameterNames());
+	}
+}
+BENCHMARK(BM_ParameterNames);
+
+static void BM_LiveEditMessages(benchmark::State &state)
+{
+	// The messages are generated, but go to a null sink instead of a MIDI port
+	auto patch = rev2Patch();
+	auto def = PyTschirpParameterIndex::forPatch(patch)->find("Cutoff");
+	auto liveEditing = midikraft::Capability::hasCapability<midikraft::SynthParameterLiveEditCapability>(def);
+	if (!liveEditing) {
+		state.SkipWithError("Cutoff has no live edit capability");
+		return;
+	}
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(liveEditing->setValueMessages(patch, rev2().get()));
+	}
+}
+BENCHMARK(BM_LiveEditMessages);
+
+static void BM_LoadSysexRev2Bank(benchmark::State &state)
+{
+	PyTschirpSynth synth(rev2());
+	auto filename = rev2BankFile();
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(synth.loadSysex(filename));
+	}
+}
+BENCHMARK(BM_LoadSysexRev2Bank)->Unit(benchmark::kMillisecond);
+
+static void BM_SaveSysexRev2Bank(benchmark::State &state)
+{
+	PyTschirpSynth synth(rev2());
+	auto patches = synth.loadSysex(rev2BankFile());
+	auto output = File::createTempFile(".syx").getFullPathName().toStdString();
+	for (auto _ : state) {
+		synth.saveSysex(output, patches, 0);
+	}
+	File(output).deleteFile();
+}
+BENCHMARK(BM_SaveSysexRev2Bank)->Unit(benchmark::kMillisecond);
+
+static void BM_NearestRev2(benchmark::State &state)
+{
+	PyTschirpSynth synth(rev2());
+	// The 512 patches of the bank repeated to the library size given as the benchmark argument
+	auto bank = synth.loadSysex(rev2BankFile());
+	std::vector<PyTschirp> patches;
+	while ((int)patches.size() < state.range(0)) {
+		patches.push_back(bank[patches.size() % bank.size()]);
+	}
+	PyTschirpPatchLibrary library(patches);
+	auto query = library.project(*rev2Patch());
+	std::vector<float> weights(query.size(), 1.0f);
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(library.nearestIndexes(query, weights, 10, 0));
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+	state.SetLabel(PyTschirpPatchLibrary::hasAvx2() ? "avx2" : "scalar");
+}
+BENCHMARK(BM_NearestRev2)->Arg(1024)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+static void BM_MutateRev2(benchmark::State &state)
+{
+	PyTschirpSynth synth(rev2());
+	auto base = synth.loadSysex(rev2BankFile())[0];
+	PyTschirpPatchGenerator generator(base, py::int_(42));
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(generator.mutate(base, (int)state.range(0), 0.2, 0.1, py::none(), 0));
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_MutateRev2)->Arg(10000)->Unit(benchmark::kMillisecond);
+
+static void BM_LoadSysexK3Bank(benchmark::State &state)
+{
+	auto filename = SystemStats::getEnvironmentVariable("PYTSCHIRP_BENCH_K3_SYX", "");
+	if (filename.isEmpty()) {
+		state.SkipWithError("Set PYTSCHIRP_BENCH_K3_SYX to a K3 bank file");
+		return;
+	}
+	PyTschirpSynth synth(std::make_shared<midikraft::KawaiK3>());
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(synth.loadSysex(filename.toStdString()));
+	}
+}
+BENCHMARK(BM_LoadSysexK3Bank)->Unit(benchmark::kMillisecond);
+
+static void BM_SaveSysexK3Bank(benchmark::State &state)
+{
+	auto filename = SystemStats::getEnvironmentVariable("PYTSCHIRP_BENCH_K3_SYX", "");
+	if (filename.isEmpty()) {
+		state.SkipWithError("Set PYTSCHIRP_BENCH_K3_SYX to a K3 bank file");
+		return;
+	}
+	PyTschirpSynth synth(std::make_shared<midikraft::KawaiK3>());
+	auto patches = synth.loadSysex(filename.toStdString());
+	auto output = File::createTempFile(".syx").getFullPathName().toStdString();
+	for (auto _ : state) {
+		synth.saveSysex(output, patches, 0);
+	}
+	File(output).deleteFile();
+}
+BENCHMARK(BM_SaveSysexK3Bank)->Unit(benchmark::kMillisecond);
+
+int main(int argc, char **argv) {
+	// Attribute get() creates Python objects, so we need an interpreter
+	py::scoped_interpreter guard{};
+
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+		return 1;
+	}
+	benchmark::RunSpecifiedBenchmarks();
+	File(rev2BankFile()).deleteFile();
+	return 0;
+}
@@ -8,3 +8,45 @@ r = Rev2()
 b = a.Slop
 
 p = r.loadSysex(R"D:\Christof\Music\ProphetRev2\VCM-Sound Set\VCM-Rev2-Soundset-U3-v1.syx")
+
+# Clones keep their values when the original is modified, no matter through which wrapper of the original patch
+import os
+import tempfile
+bank_file = os.path.join(tempfile.gettempdir(), 'pytschirp_test_bank.syx')
+r.saveSysex(bank_file, p[:4])
+bank = r.loadBank(bank_file)
+cutoff = next(i for i, name in enumerate(bank.columnNames()) if name.startswith('Cutoff'))
+
+c = bank.patch(0).clone()
+before = c.Cutoff.get()
+bank.patch(0).Cutoff = (before + 1) % 128
+assert c.Cutoff.get() == before
+bank.matrix[0, cutoff] = (before + 2) % 128
+bank.writeBack()
+assert c.Cutoff.get() == before
+assert bank.patch(0).Cutoff.get() == (before + 2) % 128
+
+parent = bank.patch(1)
+c = parent.clone()
+before = c.Cutoff.get()
+parent.Cutoff = (before + 1) % 128
+assert c.Cutoff.get() == before
+c.Cutoff = (before + 2) % 128
+assert parent.Cutoff.get() == (before + 1) % 128
+
+# A view of the data stays on the patch it was taken from
+v = memoryview(parent)
+c = parent.clone()
+parent.Cutoff = before
+del c
+assert bytes(v) == bytes(memoryview(parent))
+
+# A read only view of a clone does not copy the data, and stays valid when the clone gets its own copy
+c = parent.clone()
+v = memoryview(c)
+assert bytes(v) == bytes(memoryview(parent))
+c.Cutoff = (before + 3) % 128
+assert c.Cutoff.get() == (before + 3) % 128
+assert bytes(v) == bytes(memoryview(parent))
+del c
+assert len(bytes(v)) == len(bytes(memoryview(parent)))